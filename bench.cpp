@@ -0,0 +1,116 @@
+// replays a schedule on a virtual clock, measuring the scheduler's own
+// CPU cost without any real sleeping, then times formatting as many
+// durations as there are timers.
+// usage: clock-bench [--scheduler=heap|calendar|radix] [timers] [span]
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "spclock.h"
+#include "clock.h"
+#include "scheduler.h"
+
+namespace {
+// formats every duration the way the list table used to, through a stream
+size_t format_streamed(const std::vector<spclock::seconds>& durs) {
+    size_t chars = 0;
+    for (auto d:durs) {
+        auto t = date::make_time(d);
+        std::ostringstream oss;
+        std::string sign = (d < spclock::seconds{0}) ? "- " : "";
+        oss << sign << t.hours().count() << " hours " << t.minutes().count()
+            << " minutes " << t.seconds().count() << " seconds";
+        chars += oss.str().size();
+    }
+    return chars;
+}
+
+size_t format_into(const std::vector<spclock::seconds>& durs,
+                   spclock::duration_style style) {
+    size_t chars = 0;
+    char buf[spclock::max_duration_chars];
+    for (auto d:durs)
+        chars += spclock::format_duration(buf, d, style) - buf;
+    return chars;
+}
+
+template <typename F>
+double ns_each(size_t n, F f) {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    f();
+    return duration<double, std::nano>(steady_clock::now() - start).count() / n;
+}
+}
+
+int main(int argc, char **argv) {
+    using namespace std::chrono;
+    spclock::sched_options opts;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0].compare(0, 12, "--scheduler=") == 0) {
+        opts.backend = spclock::parse_queue_kind(args[0].substr(12));
+        args.erase(args.begin());
+    }
+    size_t count = (args.size() > 0) ? std::stoul(args[0]) : 100000;
+    int64_t span = (args.size() > 1) ? std::stoll(args[1]) : 24 * 3600;
+
+    spclock::virtual_clock vc{system_clock::now()};
+    spclock::set_clock(&vc);
+    size_t fired = 0;
+    spclock::scheduler* sched = nullptr;
+    spclock::scheduler s{[&](spclock::fire_batch b) {
+        fired += b.ids.size();
+        for (auto id:b.ids)
+            sched->stop(id);
+    }, opts};
+    sched = &s;
+
+    // fixed seed, so every run replays the same schedule
+    uint64_t seed = 88172645463325252ull;
+    std::vector<spclock::buzzer> buzzers;
+    buzzers.reserve(count);
+    for (size_t i = 0; i != count; ++i) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        spclock::seconds sec{1 + static_cast<int64_t>(seed % span)};
+        buzzers.emplace_back(sec, "timer", "bench");
+    }
+
+    auto start = steady_clock::now();
+    for (auto& b:buzzers)
+        s.add(std::move(b));
+    auto added = steady_clock::now();
+    auto batches = s.simulate(vc,
+            date::floor<spclock::seconds>(vc.now()) + spclock::seconds{span});
+    auto done = steady_clock::now();
+
+    std::cout << count << " timers over " << span << " s\n"
+              << "add:      " << duration_cast<milliseconds>(added - start).count()
+              << " ms\n"
+              << "simulate: " << duration_cast<milliseconds>(done - added).count()
+              << " ms, " << batches << " batches, " << fired << " fired"
+              << std::endl;
+
+    // time left as the list shows it, some of it overdue
+    std::vector<spclock::seconds> durs;
+    durs.reserve(count);
+    for (size_t i = 0; i != count; ++i) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        durs.emplace_back(static_cast<int64_t>(seed % span) - span / 10);
+    }
+    size_t chars = 0;
+    auto streamed = ns_each(count, [&] { chars += format_streamed(durs); });
+    auto verbose = ns_each(count, [&] {
+        chars += format_into(durs, spclock::duration_style::verbose); });
+    auto compact = ns_each(count, [&] {
+        chars += format_into(durs, spclock::duration_style::compact); });
+    std::cout << "format:   " << streamed << " ns streamed, " << verbose
+              << " ns verbose, " << compact << " ns compact per duration ("
+              << chars << " chars)" << std::endl;
+    spclock::set_clock(nullptr);
+    return (fired == count) ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "client.h"
+
+namespace spclock {
+
+namespace {
+constexpr size_t read_size = 64 * 1024;
+
+[[noreturn]] void fail(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+}
+
+client::client(const std::string& path)
+      :fd_{-1}, next_id_{1}, outstanding_{0}, in_pos_{0} {
+    std::signal(SIGPIPE, SIG_IGN);
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("Socket path is too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0)
+        fail("Cannot create socket");
+    if (::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        auto err = errno;
+        ::close(fd_);
+        errno = err;
+        fail("Cannot connect to " + path);
+    }
+    out_.append(wire_magic, sizeof(wire_magic));
+};
+
+client::~client() {
+    ::close(fd_);
+}
+
+uint32_t client::queue(request& r) {
+    r.id = next_id_++;
+    encode(r, out_);
+    ++outstanding_;
+    return r.id;
+};
+
+uint32_t client::add(b_type type, seconds sec, const std::string& message,
+                     b_priority prio, durability sync, const std::string& tag) {
+    request r;
+    r.op = wire_op::add;
+    r.seconds = sec.count();
+    r.type = static_cast<uint8_t>(type);
+    r.priority = static_cast<uint8_t>(prio);
+    r.sync = static_cast<uint8_t>(sync);
+    r.tag = tag;
+    r.message = message;
+    return queue(r);
+};
+
+uint32_t client::stop(size_t id) {
+    request r;
+    r.op = wire_op::stop;
+    r.buzzer = id;
+    return queue(r);
+};
+
+uint32_t client::snooze(size_t id, seconds sec) {
+    request r;
+    r.op = wire_op::snooze;
+    r.buzzer = id;
+    r.seconds = sec.count();
+    return queue(r);
+};
+
+uint32_t client::use(const std::string& name) {
+    request r;
+    r.op = wire_op::use;
+    r.tag = name;
+    return queue(r);
+};
+
+void client::flush() {
+    size_t off = 0;
+    while (off != out_.size()) {
+        auto n = ::write(fd_, out_.data() + off, out_.size() - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fail("Cannot send to the daemon");
+        off += n;
+    }
+    out_.clear();
+};
+
+reply client::next() {
+    flush();
+    reply r;
+    for (;;) {
+        auto n = decode(in_.data() + in_pos_, in_.size() - in_pos_, r);
+        if (n) {
+            in_pos_ += n;
+            --outstanding_;
+            return r;
+        }
+        // move the partial reply to the front before reading more
+        in_.erase(0, in_pos_);
+        in_pos_ = 0;
+        char buf[read_size];
+        auto got = ::read(fd_, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            fail("Cannot read from the daemon");
+        if (got == 0)
+            throw std::runtime_error("The daemon closed the connection");
+        in_.append(buf, got);
+    }
+};
+
+} // namespace spclock
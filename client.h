@@ -0,0 +1,52 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <cstdint>
+#include <string>
+#include "spclock.h"
+#include "journal.h"
+#include "protocol.h"
+
+namespace spclock {
+
+// client side of the binary daemon protocol. requests are queued and go
+// out together with flush(), replies come back in the order they were
+// sent. keep reading replies while pipelining, the daemon stops reading
+// from a client that leaves them unread
+class client {
+public:
+    explicit client(const std::string& path);
+    ~client();
+    client(const client&) = delete;
+    client& operator=(const client&) = delete;
+
+    // all return the request ID the reply will carry
+    uint32_t add(b_type, seconds, const std::string& message = std::string{},
+                 b_priority = b_priority::normal,
+                 durability = durability::batched,
+                 const std::string& tag = std::string{});
+    uint32_t stop(size_t);
+    uint32_t snooze(size_t, seconds);
+    // the requests after it go to the namespace, the daemon creates it if
+    // it is new
+    uint32_t use(const std::string&);
+
+    void flush();
+    // flushes, then blocks for the next reply. throws if the daemon is gone
+    reply next();
+    size_t outstanding() const { return outstanding_; }
+
+private:
+    uint32_t queue(request&);
+
+    int fd_;
+    uint32_t next_id_;
+    size_t outstanding_;
+    std::string out_;
+    std::string in_;
+    size_t in_pos_;   // start of the first unread reply in in_
+};
+
+} // namespace spclock
+
+#endif
@@ -0,0 +1,60 @@
+#include <time.h>
+#include "clock.h"
+
+namespace spclock {
+
+namespace {
+system_clock_source system_source;
+std::atomic<clock_source*> source{&system_source};
+}
+
+clock_source::time_point system_clock_source::now() const {
+    return std::chrono::system_clock::now();
+};
+
+std::chrono::nanoseconds system_clock_source::suspended() const {
+#ifdef CLOCK_BOOTTIME
+    // boottime keeps counting during a suspend, monotonic time does not
+    timespec boot, mono;
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return std::chrono::seconds{boot.tv_sec - mono.tv_sec} +
+           std::chrono::nanoseconds{boot.tv_nsec - mono.tv_nsec};
+#else
+    // the steady clock stops during a suspend on the other platforms
+    return std::chrono::system_clock::now().time_since_epoch() -
+           std::chrono::steady_clock::now().time_since_epoch();
+#endif
+};
+
+virtual_clock::virtual_clock(time_point start)
+      :now_{start.time_since_epoch().count()}, suspended_{0} { }
+
+clock_source::time_point virtual_clock::now() const {
+    return time_point{time_point::duration{now_.load()}};
+};
+
+std::chrono::nanoseconds virtual_clock::suspended() const {
+    return std::chrono::nanoseconds{suspended_.load()};
+};
+
+void virtual_clock::advance_to(time_point tp) {
+    auto t = tp.time_since_epoch().count();
+    auto cur = now_.load();
+    while (cur < t && !now_.compare_exchange_weak(cur, t)) { }
+};
+
+void virtual_clock::suspend(std::chrono::nanoseconds dur) {
+    suspended_ += dur.count();
+    now_ += std::chrono::duration_cast<time_point::duration>(dur).count();
+};
+
+clock_source& current_clock() {
+    return *source.load();
+};
+
+void set_clock(clock_source* src) {
+    source = src ? src : &system_source;
+};
+
+} // namespace spclock
@@ -0,0 +1,54 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <chrono>
+
+namespace spclock {
+
+// source of wall time behind local_time, now() and the scheduler
+class clock_source {
+public:
+    using time_point = std::chrono::system_clock::time_point;
+
+    virtual ~clock_source() = default;
+    virtual time_point now() const = 0;
+    // total time the machine spent suspended, only differences matter
+    virtual std::chrono::nanoseconds suspended() const = 0;
+    // virtual clocks never sleep, whoever owns them moves time forward
+    virtual bool is_virtual() const = 0;
+};
+
+class system_clock_source : public clock_source {
+public:
+    time_point now() const override;
+    std::chrono::nanoseconds suspended() const override;
+    bool is_virtual() const override { return false; }
+};
+
+// deterministic clock for simulations, time only moves when told to
+class virtual_clock : public clock_source {
+    std::atomic<time_point::rep> now_;
+    std::atomic<std::chrono::nanoseconds::rep> suspended_;
+
+public:
+    explicit virtual_clock(time_point start);
+
+    time_point now() const override;
+    std::chrono::nanoseconds suspended() const override;
+    bool is_virtual() const override { return true; }
+
+    // never moves backwards
+    void advance_to(time_point);
+    // pretends the machine slept for the given time
+    void suspend(std::chrono::nanoseconds);
+};
+
+clock_source& current_clock();
+// nullptr restores the system clock. meant to be called before any
+// scheduler is created
+void set_clock(clock_source*);
+
+} // namespace spclock
+
+#endif
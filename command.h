@@ -0,0 +1,230 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "parse.h"
+
+namespace spclock {
+
+// a command line split in a single pass without copying anything. words
+// are views into the line, which has to outlive them. the verb comes
+// first, the options right after it, e.g. timer --prio=critical 10:00,
+// then the arguments. words past max_words only show up in rest()
+class command_line {
+public:
+    static constexpr size_t max_words = 16;
+
+    explicit command_line(std::string_view line)
+          :line_{line}, words_{}, count_{0}, opts_{}, opt_count_{0} {
+        size_t i = 0;
+        while (count_ != max_words) {
+            while (i != line.size() && blank(line[i]))
+                ++i;
+            if (i == line.size())
+                break;
+            auto start = i;
+            while (i != line.size() && !blank(line[i]))
+                ++i;
+            auto word = line.substr(start, i - start);
+            if (count_ == 1 && opt_count_ != max_words && word.size() > 2 &&
+                word.compare(0, 2, "--") == 0)
+                opts_[opt_count_++] = word;
+            else
+                words_[count_++] = word;
+        }
+    }
+
+    bool empty() const { return count_ == 0; }
+    // the verb and the arguments
+    size_t size() const { return count_; }
+    std::string_view operator[](size_t i) const { return words_[i]; }
+
+    const std::string_view* begin_options() const { return opts_.data(); }
+    const std::string_view* end_options() const { return opts_.data() + opt_count_; }
+
+    // from argument i to the end of the line, blanks in between kept.
+    // empty if there is no such argument
+    std::string_view rest(size_t i) const {
+        if (i >= count_)
+            return {};
+        auto tail = line_.substr(words_[i].data() - line_.data());
+        return tail.substr(0, tail.find_last_not_of(" \t\r\n") + 1);
+    }
+
+private:
+    static bool blank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    std::string_view line_;
+    std::array<std::string_view, max_words> words_;
+    size_t count_;
+    std::array<std::string_view, max_words> opts_;
+    size_t opt_count_;
+};
+
+// splits --key=value into key and value
+inline void split_option(std::string_view opt, std::string_view& key,
+                         std::string_view& val) {
+    auto eq = opt.find('=');
+    key = opt.substr(2, eq == std::string_view::npos ? eq : eq - 2);
+    val = (eq == std::string_view::npos) ? std::string_view{} : opt.substr(eq + 1);
+}
+
+// a whole decimal number, throws on anything else
+inline size_t parse_number(std::string_view str) {
+    size_t ret = 0;
+    auto end = str.data() + str.size();
+    auto r = std::from_chars(str.data(), end, ret);
+    if (str.empty() || r.ec != std::errc{} || r.ptr != end)
+        throw std::invalid_argument("Not a number: " + std::string{str});
+    return ret;
+}
+
+// what an argument has to look like
+enum class arg_type : uint8_t {
+    time,    // parsed with parse_time
+    number,  // parsed with parse_number
+    word,    // taken as it is
+    text     // the rest of the line, blanks in between kept. only last
+};
+
+// an argument after parsing, only the member of its type is set
+struct arg_value {
+    bool given = false;
+    seconds time{0};
+    size_t number = 0;
+    std::string_view text;
+};
+
+struct command_args {
+    static constexpr size_t max_args = 3;
+    std::array<arg_value, max_args> values;
+    const arg_value& operator[](size_t i) const { return values[i]; }
+};
+
+using command_handler = void (*)(const command_line&, const command_args&,
+                                 std::ostream&);
+
+// a verb and its arguments, min_args of them at least. with fewer than
+// all, the ones at the end are left out, or with skip_leading the ones at
+// the front, e.g. snooze [ID] [time]. commands without options_allowed
+// take no --options
+struct command_spec {
+    std::string_view verb;
+    command_handler handler = nullptr;
+    uint8_t min_args = 0;
+    uint8_t max_args = 0;
+    std::array<arg_type, command_args::max_args> types{};
+    bool options_allowed = false;
+    bool skip_leading = false;
+};
+
+// parses the arguments of a command line with the verb of spec once,
+// before the handler gets them. false if there are too few or too many,
+// throws if one does not parse
+inline bool parse_args(const command_spec& spec, const command_line& cmds,
+                       command_args& args) {
+    if (!spec.options_allowed && cmds.begin_options() != cmds.end_options())
+        throw std::invalid_argument("Unknown option: " + std::string{*cmds.begin_options()});
+    size_t given = cmds.size() - 1;
+    bool text = spec.max_args && spec.types[spec.max_args - 1] == arg_type::text;
+    if (text && given > spec.max_args)
+        given = spec.max_args;
+    if (given < spec.min_args || given > spec.max_args)
+        return false;
+    size_t first = spec.skip_leading ? spec.max_args - given : 0;
+    args = command_args{};
+    for (size_t i = 0; i != given; ++i) {
+        auto& v = args.values[first + i];
+        auto word = cmds[i + 1];
+        v.given = true;
+        switch (spec.types[first + i]) {
+        case arg_type::time:
+            v.time = parse_time(word);
+            break;
+        case arg_type::number:
+            v.number = parse_number(word);
+            break;
+        case arg_type::word:
+            v.text = word;
+            break;
+        case arg_type::text:
+            v.text = cmds.rest(i + 1);
+            break;
+        }
+    }
+    return true;
+}
+
+// hashes a verb, different seeds give different hashes
+constexpr uint32_t verb_hash(std::string_view verb, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (char c:verb) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// the commands there are, built at compile time. the seed of the hash is
+// searched for until no two verbs share a slot, so finding a verb is one
+// hash, one load and one compare however many there are
+template <size_t N, size_t Slots>
+class command_table {
+    static_assert((Slots & (Slots - 1)) == 0, "Slots has to be a power of two");
+    static_assert(N < Slots && N < 256, "Too many commands for the slots");
+
+public:
+    constexpr explicit command_table(const command_spec (&specs)[N])
+          :specs_{}, slots_{}, seed_{0} {
+        for (size_t i = 0; i != N; ++i)
+            specs_[i] = specs[i];
+        while (!place())
+            ++seed_;
+    }
+
+    // nullptr for an unknown verb
+    constexpr const command_spec* find(std::string_view verb) const {
+        auto i = slots_[verb_hash(verb, seed_) & (Slots - 1)];
+        if (i == 0 || specs_[i - 1].verb != verb)
+            return nullptr;
+        return &specs_[i - 1];
+    }
+
+    constexpr size_t size() const { return N; }
+
+private:
+    // slots hold the index of the spec plus one, zero is free
+    constexpr bool place() {
+        for (auto& s:slots_)
+            s = 0;
+        for (size_t i = 0; i != N; ++i) {
+            auto& s = slots_[verb_hash(specs_[i].verb, seed_) & (Slots - 1)];
+            if (s != 0)
+                return false;
+            s = static_cast<uint8_t>(i + 1);
+        }
+        return true;
+    }
+
+    std::array<command_spec, N> specs_;
+    std::array<uint8_t, Slots> slots_;
+    uint32_t seed_;
+};
+
+template <size_t Slots, size_t N>
+constexpr command_table<N, Slots> make_command_table(const command_spec (&specs)[N]) {
+    return command_table<N, Slots>{specs};
+}
+
+} // namespace spclock
+
+#endif
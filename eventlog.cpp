@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include "eventlog.h"
+
+namespace spclock {
+
+namespace {
+constexpr char magic[8] = {'S', 'P', 'C', 'L', 'O', 'G', '0', '1'};
+
+std::atomic<uint64_t> next_serial{1};
+
+const char* event_name(log_event e) {
+    switch (e) {
+    case log_event::added:
+        return "added";
+    case log_event::fired:
+        return "fired";
+    case log_event::acknowledged:
+        return "acknowledged";
+    case log_event::cancelled:
+        return "cancelled";
+    case log_event::late:
+        return "late";
+    case log_event::snoozed:
+        return "snoozed";
+    case log_event::named:
+        return "named";
+    }
+    return "?";
+}
+
+void append_number(std::string& out, int64_t n) {
+    char buf[24];
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), n).ptr);
+}
+
+void write_full(int fd, const std::string& s) {
+    for (size_t off = 0; off != s.size(); ) {
+        auto n = ::write(fd, s.data() + off, s.size() - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        off += n;
+    }
+}
+}
+
+constexpr size_t event_log::ring_capacity;
+constexpr std::chrono::milliseconds event_log::flush_interval;
+thread_local event_log::holder event_log::held_;
+
+log_format parse_log_format(const std::string& str) {
+    if (str == "json")
+        return log_format::json;
+    if (str == "binary")
+        return log_format::binary;
+    throw std::invalid_argument("Unknown event log format: " + str);
+};
+
+event_log::event_log(const std::string& path, log_format format)
+      :fd_{::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)},
+       format_{format}, serial_{next_serial++}, names_written_{0}, written_{0},
+       quit_{false} {
+    if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+    // a binary log appended to keeps the magic it has
+    if (format_ == log_format::binary && ::lseek(fd_, 0, SEEK_END) == 0)
+        write_full(fd_, std::string(magic, sizeof(magic)));
+    writer_ = std::thread{&event_log::run, this};
+};
+
+event_log::~event_log() {
+    {
+        std::lock_guard<std::mutex> lck(quit_m_);
+        quit_ = true;
+    }
+    quit_cv_.notify_one();
+    writer_.join();
+    ::close(fd_);
+}
+
+uint16_t event_log::space(const std::string& name) {
+    std::lock_guard<std::mutex> lck(names_m_);
+    auto itr = std::find(names_.begin(), names_.end(), name);
+    if (itr != names_.end())
+        return static_cast<uint16_t>(itr - names_.begin());
+    names_.push_back(name);
+    return static_cast<uint16_t>(names_.size() - 1);
+};
+
+void event_log::holder::take(uint64_t s, std::shared_ptr<ring> given) {
+    if (r)
+        r->owned.store(false, std::memory_order_release);
+    serial = s;
+    r = std::move(given);
+}
+
+event_log::holder::~holder() {
+    take(0, nullptr);
+}
+
+// the ring is found without a lock after the first event of a thread.
+// one given back may still have records the writer has not taken, the
+// new owner carries on after them
+event_log::ring& event_log::local() {
+    if (held_.serial == serial_)
+        return *held_.r;
+    std::lock_guard<std::mutex> lck(rings_m_);
+    std::shared_ptr<ring> r;
+    for (auto& free:rings_) {
+        bool owned = false;
+        if (free->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+            r = free;
+            break;
+        }
+    }
+    if (!r) {
+        r = std::make_shared<ring>();
+        rings_.push_back(r);
+    }
+    held_.take(serial_, std::move(r));
+    return *held_.r;
+}
+
+void event_log::record(log_event e, uint16_t space, size_t id, int64_t deadline) {
+    auto& r = local();
+    auto head = r.head.load(std::memory_order_relaxed);
+    if (head - r.tail.load(std::memory_order_acquire) == ring_capacity) {
+        r.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    auto& slot = r.slots[head % ring_capacity];
+    slot.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    slot.deadline = deadline;
+    slot.id = id;
+    slot.space = space;
+    slot.event = e;
+    r.head.store(head + 1, std::memory_order_release);
+};
+
+uint64_t event_log::dropped() {
+    uint64_t ret = 0;
+    std::lock_guard<std::mutex> lck(rings_m_);
+    for (auto& r:rings_)
+        ret += r->dropped.load(std::memory_order_relaxed);
+    return ret;
+};
+
+void event_log::run() {
+    std::vector<log_record> batch;
+    std::string out;
+    std::vector<std::string> names;
+    std::unique_lock<std::mutex> lck(quit_m_);
+    for (;;) {
+        auto quit = quit_cv_.wait_for(lck, flush_interval, [this] { return quit_; });
+        lck.unlock();
+        // keeps up with a burst while it lasts
+        while (flush(batch, out, names, quit))
+            ;
+        lck.lock();
+        if (quit)
+            return;
+    }
+};
+
+// takes everything out of the rings, puts it in time order with what was
+// held back before and writes what is older than flush_interval, or all
+// of it. returns how many went out
+size_t event_log::flush(std::vector<log_record>& batch, std::string& out,
+                        std::vector<std::string>& names, bool all) {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    auto cut = std::chrono::duration_cast<std::chrono::nanoseconds>(now - flush_interval).count();
+    auto before = batch.size();
+    {
+        std::lock_guard<std::mutex> lck(rings_m_);
+        for (auto& r:rings_) {
+            auto tail = r->tail.load(std::memory_order_relaxed);
+            auto head = r->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail)
+                batch.push_back(r->slots[tail % ring_capacity]);
+            r->tail.store(head, std::memory_order_release);
+        }
+    }
+    auto by_time = [](const log_record& a, const log_record& b) {
+        return a.time_ns < b.time_ns;
+    };
+    if (batch.size() != before)
+        std::stable_sort(batch.begin(), batch.end(), by_time);
+    auto end = batch.end();
+    if (!all) {
+        log_record last{};
+        last.time_ns = cut;
+        end = std::upper_bound(batch.begin(), batch.end(), last, by_time);
+    }
+    size_t count = end - batch.begin();
+    if (!count)
+        return 0;
+    {
+        // names only ever grow
+        std::lock_guard<std::mutex> lck(names_m_);
+        names.insert(names.end(), names_.begin() + names.size(), names_.end());
+    }
+
+    out.clear();
+    if (format_ == log_format::binary) {
+        for (; names_written_ != names.size(); ++names_written_) {
+            auto& name = names[names_written_];
+            log_record named{};
+            named.space = static_cast<uint16_t>(names_written_);
+            named.deadline = name.size();
+            named.event = log_event::named;
+            out.append(reinterpret_cast<const char*>(&named), sizeof(named));
+            out += name;
+            out.append((sizeof(named) - name.size() % sizeof(named)) % sizeof(named), '\0');
+        }
+        out.append(reinterpret_cast<const char*>(batch.data()),
+                   count * sizeof(log_record));
+    } else {
+        for (auto r = batch.begin(); r != end; ++r) {
+            out += "{\"time_ns\":";
+            append_number(out, r->time_ns);
+            out += ",\"event\":\"";
+            out += event_name(r->event);
+            out += "\",\"namespace\":\"";
+            out += names[r->space];
+            out += "\",\"id\":";
+            append_number(out, static_cast<int64_t>(r->id));
+            out += ",\"deadline\":";
+            append_number(out, r->deadline);
+            out += "}\n";
+        }
+    }
+    write_full(fd_, out);
+    written_.fetch_add(count, std::memory_order_relaxed);
+    batch.erase(batch.begin(), end);
+    return count;
+};
+
+} // namespace spclock
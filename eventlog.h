@@ -0,0 +1,117 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace spclock {
+
+enum class log_event : uint8_t {
+    added,
+    fired,
+    acknowledged,   // stopped while ringing
+    cancelled,      // stopped before it went off
+    late,           // found overdue after a resume
+    snoozed,
+    named           // binary files only, names a namespace
+};
+
+enum class log_format {
+    json,   // a line per event
+    binary  // log_record after log_record
+};
+
+log_format parse_log_format(const std::string&);
+
+// an event as it is kept and as the binary format writes it. a named
+// record has the namespace index in space and the length of the name in
+// deadline, the name follows padded to a whole record
+struct log_record {
+    int64_t time_ns;    // since epoch
+    int64_t deadline;   // seconds since epoch
+    uint64_t id;
+    uint16_t space;     // index of the namespace
+    log_event event;
+    uint8_t unused[5];
+};
+
+// an audit trail of what happens to buzzers. every thread recording
+// events gets a ring buffer of its own, which only it writes and only the
+// writer thread reads, so recording takes no lock and never waits: with
+// the ring full the event is counted and lost. a thread that exits hands
+// its ring over to the next one. the writer drains all rings and appends
+// them in time order, again right away for as long as there is
+// something, otherwise every flush_interval. what is newer than
+// flush_interval waits for the next drain, so an event another ring only
+// has by then still goes ahead of it. one whose thread stalls longer
+// between taking the time and recording can be out of order
+class event_log {
+public:
+    static constexpr size_t ring_capacity = 65536;
+    static constexpr std::chrono::milliseconds flush_interval{50};
+
+    // throws if the file cannot be opened. a new binary file starts
+    // with the magic SPCLOG01
+    event_log(const std::string& path, log_format);
+    // writes what is left first
+    ~event_log();
+    event_log(const event_log&) = delete;
+    event_log& operator=(const event_log&) = delete;
+
+    // the index records of the namespace carry. takes a lock, it is
+    // meant to be looked up once
+    uint16_t space(const std::string& name);
+    void record(log_event, uint16_t space, size_t id, int64_t deadline);
+
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped();
+
+private:
+    struct ring {
+        std::unique_ptr<log_record[]> slots{new log_record[ring_capacity]()};
+        alignas(64) std::atomic<uint64_t> head{0};  // next to write
+        alignas(64) std::atomic<uint64_t> tail{0};  // next to read
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> owned{true};   // by a thread still recording
+    };
+    // the ring of a thread, given back when the thread exits or records
+    // to another log. shared, so the ring outlives a log destroyed first
+    struct holder {
+        uint64_t serial = 0;   // of the log the ring belongs to
+        std::shared_ptr<ring> r;
+
+        void take(uint64_t, std::shared_ptr<ring>);
+        ~holder();
+    };
+    static thread_local holder held_;
+
+    ring& local();
+    void run();
+    size_t flush(std::vector<log_record>&, std::string&, std::vector<std::string>&,
+                 bool all);
+
+    int fd_;
+    log_format format_;
+    uint64_t serial_;   // tells the logs apart for the thread locals
+    std::mutex rings_m_;
+    std::vector<std::shared_ptr<ring>> rings_;
+    std::mutex names_m_;
+    std::vector<std::string> names_;
+    size_t names_written_;  // only the writer touches it
+    std::atomic<uint64_t> written_;
+    bool quit_;
+    std::mutex quit_m_;
+    std::condition_variable quit_cv_;
+    std::thread writer_;
+};
+
+} // namespace spclock
+
+#endif
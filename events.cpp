@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "events.h"
+
+namespace spclock {
+
+namespace {
+const char* kind_name(event_kind k) {
+    switch (k) {
+    case event_kind::fire:
+        return "fire";
+    case event_kind::cancel:
+        return "cancel";
+    case event_kind::snooze:
+        return "snooze";
+    }
+    return "?";
+}
+}
+
+lag_policy parse_lag_policy(const std::string& str) {
+    if (str == "mark")
+        return lag_policy::mark;
+    if (str == "drop")
+        return lag_policy::drop;
+    throw std::invalid_argument("Unknown slow subscriber policy: " + str);
+};
+
+event_hub::subscription::subscription(event_hub& hub, std::string tag,
+                                      size_t capacity)
+      :hub_(hub), tag_{std::move(tag)}, ring_(capacity), head_{0}, tail_{0},
+       lost_{0}, dropped_{false} { }
+
+event_hub::subscription::~subscription() {
+    std::lock_guard<std::mutex> lck(hub_.m_);
+    auto& subs = hub_.subs_;
+    subs.erase(std::remove(subs.begin(), subs.end(), this), subs.end());
+}
+
+event_hub::event_hub(wake_handler wake, lag_policy policy, size_t capacity)
+      :wake_{std::move(wake)}, policy_{policy}, capacity_{capacity} { }
+
+std::shared_ptr<event_hub::subscription>
+event_hub::subscribe(const std::string& tag) {
+    std::shared_ptr<subscription> sub{new subscription(*this, tag, capacity_)};
+    std::lock_guard<std::mutex> lck(m_);
+    subs_.push_back(sub.get());
+    return sub;
+};
+
+void event_hub::publish(const sched_event& ev) {
+    bool woke = false;
+    std::lock_guard<std::mutex> lck(m_);
+    for (auto s:subs_) {
+        if (s->dropped_)
+            continue;
+        if (!s->tag_.empty() && (s->tag_.size() != ev.tag.size ||
+                std::memcmp(s->tag_.data(), ev.tag.data, ev.tag.size) != 0))
+            continue;
+        if (s->tail_ - s->head_ == s->ring_.size()) {
+            if (policy_ == lag_policy::drop)
+                s->dropped_ = true;
+            else
+                ++s->lost_;
+            woke = true;
+            continue;
+        }
+        woke |= s->tail_ == s->head_;
+        auto& slot = s->ring_[s->tail_++ % s->ring_.size()];
+        slot.kind = ev.kind;
+        slot.id = ev.id;
+        slot.deadline = ev.deadline;
+        slot.tag.assign(ev.tag.data, ev.tag.size);
+        slot.message.assign(ev.message.data, ev.message.size);
+    }
+    // the owner drains every subscriber it has, one call is enough
+    if (woke && wake_)
+        wake_();
+};
+
+bool event_hub::drain(subscription& s, std::string& out) {
+    std::lock_guard<std::mutex> lck(m_);
+    for (; s.head_ != s.tail_; ++s.head_) {
+        auto& ev = s.ring_[s.head_ % s.ring_.size()];
+        out += kind_name(ev.kind);
+        out += ' ';
+        out += std::to_string(ev.id);
+        out += ' ';
+        out += std::to_string(ev.deadline);
+        out += ' ';
+        if (!ev.tag.empty())
+            out += ev.tag;
+        else
+            out += '-';
+        out += ' ';
+        out += ev.message;
+        out += '\n';
+    }
+    // whatever was lost came after the events in the ring
+    if (s.lost_) {
+        out += "lagged " + std::to_string(s.lost_) + "\n";
+        s.lost_ = 0;
+    }
+    if (s.dropped_)
+        out += "dropped\n";
+    return !s.dropped_;
+};
+
+} // namespace spclock
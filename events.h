@@ -0,0 +1,100 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "messages.h"
+
+namespace spclock {
+
+enum class event_kind : uint8_t {
+    fire,
+    cancel,
+    snooze
+};
+
+// a change of one buzzer. tag and message point into the message pool,
+// they are only good while the observer runs
+struct sched_event {
+    event_kind kind;
+    size_t id;
+    int64_t deadline;   // seconds since epoch, the new one for a snooze
+    msg_ref tag;
+    msg_ref message;
+};
+
+// what happens to a subscriber whose buffer is full
+enum class lag_policy {
+    mark,  // newer events are lost, the next delivery says how many
+    drop   // it is unsubscribed
+};
+
+lag_policy parse_lag_policy(const std::string&);
+
+// fans scheduler events out to subscribers. each one has a ring buffer of
+// its own, publishing copies the event into the matching rings and never
+// waits for a subscriber. the wake handler runs when a ring goes from
+// empty to non empty, the owner of the subscriber then drains everything
+// that piled up in one go
+class event_hub {
+public:
+    class subscription {
+    public:
+        ~subscription();
+        subscription(const subscription&) = delete;
+        subscription& operator=(const subscription&) = delete;
+
+    private:
+        friend class event_hub;
+        subscription(event_hub&, std::string, size_t);
+
+        // an event with copies of its texts, the strings of a slot keep
+        // their room for the next event in it
+        struct held_event {
+            event_kind kind;
+            size_t id;
+            int64_t deadline;
+            std::string tag;
+            std::string message;
+        };
+
+        event_hub& hub_;
+        std::string tag_;               // empty matches every buzzer
+        std::vector<held_event> ring_;
+        uint64_t head_;                 // next to deliver
+        uint64_t tail_;                 // next free slot
+        uint64_t lost_;                 // since the last delivery
+        bool dropped_;
+    };
+
+    using wake_handler = std::function<void()>;
+
+    explicit event_hub(wake_handler, lag_policy = lag_policy::mark,
+                       size_t capacity = 4096);
+    event_hub(const event_hub&) = delete;
+    event_hub& operator=(const event_hub&) = delete;
+
+    // unsubscribes when the last reference goes away. the hub has to
+    // outlive its subscriptions
+    std::shared_ptr<subscription> subscribe(const std::string& tag);
+    void publish(const sched_event&);
+    // appends the pending events as text lines of the form
+    //   <kind> <id> <deadline> <tag or -> <message>
+    // returns false once the subscription is dropped
+    bool drain(subscription&, std::string&);
+
+private:
+    wake_handler wake_;
+    lag_policy policy_;
+    size_t capacity_;
+    std::vector<subscription*> subs_;
+    std::mutex m_;
+};
+
+} // namespace spclock
+
+#endif
@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "journal.h"
+
+namespace spclock {
+
+namespace {
+constexpr char magic[8] = {'S', 'P', 'C', 'J', 'R', 'N', 'L', '1'};
+// the first record sized slot holds the magic and the sequence number the
+// file starts at, zero meaning one
+constexpr size_t header = sizeof(journal_record);
+constexpr size_t first_seq = sizeof(magic);
+constexpr size_t initial_records = 16 * 1024;
+
+uint32_t checksum(journal_record rec) {
+    rec.check = 0;
+    auto p = reinterpret_cast<const unsigned char*>(&rec);
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i != sizeof(rec); ++i) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+[[noreturn]] void fail(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+int sync_data(int fd) {
+#ifdef __linux__
+    // also writes back the dirty pages of the shared mapping
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+}
+
+durability parse_durability(std::string_view str) {
+    if (str == "none")
+        return durability::none;
+    if (str == "batched")
+        return durability::batched;
+    if (str == "immediate")
+        return durability::immediate;
+    throw std::invalid_argument("Unknown durability: " + std::string{str});
+};
+
+void sync_dir(const std::string& path) {
+    auto slash = path.rfind('/');
+    auto dir = (slash == std::string::npos) ? std::string{"."} :
+               path.substr(0, slash + 1);
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+};
+
+journal::journal(const std::string& path, milliseconds window)
+      :path_{path}, fd_{-1}, base_{nullptr}, capacity_{0}, epoch_{0}, tail_{0}, seq_{0},
+       synced_{0}, commits_{0}, error_{0}, window_{window}, urgent_{false},
+       done_{false} {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0)
+        fail("Cannot open journal " + path);
+    struct stat st;
+    if (fstat(fd_, &st) < 0) {
+        ::close(fd_);
+        fail("Cannot stat journal " + path);
+    }
+
+    auto records = (static_cast<size_t>(st.st_size) > header) ?
+                   (st.st_size - header) / sizeof(journal_record) : 0;
+    map(std::max(records, initial_records));
+    if (st.st_size == 0) {
+        std::memcpy(base_, magic, sizeof(magic));
+    } else if (std::memcmp(base_, magic, sizeof(magic)) != 0) {
+        munmap(base_, header + capacity_ * sizeof(journal_record));
+        ::close(fd_);
+        throw std::runtime_error("Not a journal: " + path);
+    }
+    committer_ = std::thread{&journal::commit_loop, this};
+};
+
+journal::~journal() {
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        done_ = true;
+    }
+    commit_cv_.notify_one();
+    committer_.join();
+    if (base_)
+        munmap(base_, header + capacity_ * sizeof(journal_record));
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+// (re)maps the file at the given capacity, growing it if needed
+void journal::map(size_t records) {
+    if (base_)
+        munmap(base_, header + capacity_ * sizeof(journal_record));
+    base_ = nullptr;
+    base_ = map_file(fd_, records, path_);
+    capacity_ = records;
+    ++epoch_;
+};
+
+// a new mapping of the file at the given capacity, growing it if needed.
+// it touches no member, the commit thread calls it unlocked
+char* journal::map_file(int fd, size_t records, const std::string& path) {
+    auto bytes = header + records * sizeof(journal_record);
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        (static_cast<size_t>(st.st_size) < bytes && ftruncate(fd, bytes) < 0))
+        fail("Cannot grow journal " + path);
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        fail("Cannot map journal " + path);
+    return static_cast<char*>(p);
+};
+
+journal_record* journal::slot(size_t i) const {
+    return reinterpret_cast<journal_record*>(base_ + header) + i;
+};
+
+// stops at the first record that is torn or out of sequence
+size_t journal::replay(const std::function<void(const journal_record&)>& f) {
+    std::lock_guard<std::mutex> lck(m_);
+    madvise(base_, header + capacity_ * sizeof(journal_record), MADV_SEQUENTIAL);
+    uint64_t first;
+    std::memcpy(&first, base_ + first_seq, sizeof(first));
+    seq_ = first ? first - 1 : 0;
+    size_t n = 0;
+    for (; n != capacity_; ++n) {
+        auto& rec = *slot(n);
+        if (rec.seq != seq_ + 1 || rec.check != checksum(rec))
+            break;
+        f(rec);
+        seq_ = rec.seq;
+    }
+    tail_ = n;
+    synced_ = seq_;
+    madvise(base_, header + capacity_ * sizeof(journal_record), MADV_NORMAL);
+    return n;
+};
+
+uint64_t journal::append(journal_record rec) {
+    std::lock_guard<std::mutex> lck(m_);
+    // the commit thread did not get to grow it in time
+    if (tail_ == capacity_)
+        map(capacity_ * 2);
+    rec.seq = ++seq_;
+    rec.check = checksum(rec);
+    *slot(tail_++) = rec;
+    if (tap_)
+        tap_(rec);
+    commit_cv_.notify_one();
+    return rec.seq;
+};
+
+uint64_t journal::append_text(rec_op op, uint32_t ref, const char* data,
+                          size_t size) {
+    journal_record rec{};
+    rec.op = op;
+    rec.ref = ref;
+    rec.id = size;
+    size_t off = 0;
+    uint64_t seq;
+    do {
+        auto n = std::min(size - off, sizeof(rec.text));
+        rec.deadline = off;
+        rec.len = static_cast<uint8_t>(n);
+        std::memset(rec.text, 0, sizeof(rec.text));
+        std::memcpy(rec.text, data + off, n);
+        seq = append(rec);
+        off += n;
+    } while (off < size);
+    return seq;
+};
+
+// the file is cut back to its initial size, which also zeroes the old
+// records. the header keeps the sequence going so a record left behind by
+// a crash halfway through never looks like the next one
+void journal::reset() {
+    std::lock_guard<std::mutex> lck(m_);
+    auto first = seq_ + 1;
+    std::memcpy(base_ + first_seq, &first, sizeof(first));
+    munmap(base_, header + capacity_ * sizeof(journal_record));
+    base_ = nullptr;
+    if (ftruncate(fd_, header) < 0)
+        fail("Cannot truncate journal " + path_);
+    map(initial_records);
+    auto r = sync_data(fd_);
+    tail_ = 0;
+    if (r < 0) {
+        error_ = errno;
+        synced_cv_.notify_all();
+        errno = error_;
+        fail("Cannot sync journal " + path_);
+    }
+    synced_ = seq_;
+    error_ = 0;
+    synced_cv_.notify_all();
+    commit_cv_.notify_one();
+    if (on_sync_)
+        on_sync_();
+};
+
+// nothing here waits for the disk. the old file is handed to the commit
+// thread, which syncs it, the directory with both names and the new file
+// before any record appended so far counts as synced
+void journal::rotate(const std::string& to) {
+    std::lock_guard<std::mutex> lck(m_);
+    if (::rename(path_.c_str(), to.c_str()) < 0)
+        fail("Cannot rename journal " + path_);
+    int fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail("Cannot open journal " + path_);
+    retired_.push_back({fd_, base_, header + capacity_ * sizeof(journal_record)});
+    base_ = nullptr;
+    fd_ = fd;
+    try {
+        map(initial_records);
+    } catch (...) {
+        // appends go on in the old one, under its new name
+        auto old = retired_.back();
+        retired_.pop_back();
+        ::close(fd_);
+        fd_ = old.fd;
+        base_ = old.base;
+        throw;
+    }
+    auto first = seq_ + 1;
+    std::memcpy(base_, magic, sizeof(magic));
+    std::memcpy(base_ + first_seq, &first, sizeof(first));
+    tail_ = 0;
+    commit_cv_.notify_one();
+};
+
+size_t journal::records() {
+    std::lock_guard<std::mutex> lck(m_);
+    return tail_;
+};
+
+void journal::tap(std::function<void(const journal_record&)> f) {
+    std::lock_guard<std::mutex> lck(m_);
+    tap_ = std::move(f);
+};
+
+uint64_t journal::last_seq() {
+    std::lock_guard<std::mutex> lck(m_);
+    return seq_;
+};
+
+void journal::commit(uint64_t seq, durability level) {
+    if (level == durability::none)
+        return;
+    std::unique_lock<std::mutex> lck(m_);
+    if (synced_ >= seq)
+        return;
+    if (level == durability::immediate) {
+        urgent_ = true;
+        commit_cv_.notify_one();
+    }
+    synced_cv_.wait(lck, [&]{ return synced_ >= seq || error_; });
+    if (synced_ < seq)
+        throw std::system_error(error_, std::generic_category(),
+                                "Cannot sync journal " + path_);
+};
+
+bool journal::committed(uint64_t seq, durability level) {
+    if (level == durability::none)
+        return true;
+    std::lock_guard<std::mutex> lck(m_);
+    if (synced_ >= seq)
+        return true;
+    if (error_)
+        throw std::system_error(error_, std::generic_category(),
+                                "Cannot sync journal " + path_);
+    if (level == durability::immediate && !urgent_) {
+        urgent_ = true;
+        commit_cv_.notify_one();
+    }
+    return false;
+};
+
+void journal::on_sync(std::function<void()> f) {
+    std::lock_guard<std::mutex> lck(m_);
+    on_sync_ = std::move(f);
+};
+
+journal_stats journal::stats() {
+    std::lock_guard<std::mutex> lck(m_);
+    return {seq_, synced_, commits_};
+};
+
+// group commit. once something is appended it waits out the window, or
+// less if someone asked for an immediate commit, then syncs everything
+// appended so far at once. appends go on while the sync runs. a journal
+// half full gets a mapping twice the size meanwhile, which replaces the
+// old one unless the file was remapped in between. files rotated away are
+// synced and closed first. after a failed sync it waits for a reset, a
+// later sync succeeding would not mean the pages written before it made it
+void journal::commit_loop() {
+    std::unique_lock<std::mutex> lck(m_);
+    std::vector<retired_file> retired;
+    for (;;) {
+        commit_cv_.wait(lck, [&]{
+            return done_ || !retired_.empty() || (synced_ < seq_ && !error_); });
+        bool behind = synced_ < seq_ && !error_;
+        if (!behind && retired_.empty())
+            return;
+        if (behind && !done_)
+            commit_cv_.wait_for(lck, window_, [&]{ return urgent_ || done_; });
+        urgent_ = false;
+        auto target = seq_;
+        auto grow = (tail_ * 2 >= capacity_) ? capacity_ * 2 : 0;
+        auto epoch = epoch_;
+        // only this thread closes a file rotate() let go of
+        int fd = fd_;
+        retired.swap(retired_);
+        lck.unlock();
+        int err = 0;
+        for (auto& f:retired) {
+            if (sync_data(f.fd) < 0)
+                err = errno;
+            munmap(f.base, f.bytes);
+            ::close(f.fd);
+        }
+        if (!retired.empty())
+            sync_dir(path_);
+        retired.clear();
+        if (sync_data(fd) < 0)
+            err = errno;
+        char* grown = nullptr;
+        if (grow) {
+            try {
+                grown = map_file(fd, grow, path_);
+            } catch (std::exception&) {
+                // an append grows it then, or fails
+            }
+        }
+        lck.lock();
+        if (err)
+            error_ = err;
+        else if (!error_)
+            synced_ = std::max(synced_, target);
+        ++commits_;
+        synced_cv_.notify_all();
+        if (on_sync_)
+            on_sync_();
+        if (!grown)
+            continue;
+        auto old = grown;
+        auto old_capacity = grow;
+        if (epoch == epoch_) {
+            old = base_;
+            old_capacity = capacity_;
+            base_ = grown;
+            capacity_ = grow;
+            ++epoch_;
+        }
+        lck.unlock();
+        munmap(old, header + old_capacity * sizeof(journal_record));
+        lck.lock();
+    }
+};
+
+} // namespace spclock
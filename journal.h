@@ -0,0 +1,149 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace spclock {
+
+enum class rec_op : uint8_t {
+    intern = 1,  // message text for a handle
+    zone,        // time zone name for an index
+    add,
+    stop,
+    snooze,
+    fire,
+    tag          // tag handle of the buzzer added just before
+};
+
+// fixed size journal entry. a text longer than one record spans several
+// records of the same op, each one carrying its offset
+struct journal_record {
+    uint64_t seq;       // starts at 1, zero is free space
+    uint64_t id;        // buzzer ID, or the full length of a text
+    int64_t deadline;   // seconds since epoch, or the offset into a text
+    uint32_t ref;       // message handle, or zone index of a zone record
+    uint32_t check;
+    uint16_t zone;
+    rec_op op;
+    uint8_t arg;        // b_type for add, the new b_state for stop and fire
+    uint8_t prio;
+    uint8_t len;        // text bytes in this record
+    char text[26];
+};
+
+static_assert(sizeof(journal_record) == 64, "journal records are 64 bytes");
+
+// how long a change waits for the disk before it is acknowledged
+enum class durability {
+    none,       // not at all, it is synced with the next batch
+    batched,    // until the batch it went into is synced
+    immediate   // until it is synced, without waiting for the window
+};
+
+durability parse_durability(std::string_view);
+
+// syncs the directory holding the file, so a rename or a file created in
+// it survives a crash
+void sync_dir(const std::string&);
+
+struct journal_stats {
+    uint64_t appended;
+    uint64_t synced;
+    uint64_t commits;  // fdatasync calls
+};
+
+// append-only journal of scheduler changes in a memory mapped file.
+// an append is a copy into the mapping. a commit thread syncs whatever
+// was appended during a window with a single fdatasync, and grows the
+// file and the mapping once it is half full, so an append only has to
+// when it got there first
+class journal {
+public:
+    using milliseconds = std::chrono::milliseconds;
+
+    explicit journal(const std::string&, milliseconds = milliseconds{10});
+    ~journal();
+    journal(const journal&) = delete;
+    journal& operator=(const journal&) = delete;
+
+    // calls f for every intact record in order, later appends go after
+    // the last one. returns the number of records
+    size_t replay(const std::function<void(const journal_record&)>&);
+
+    // both return the sequence number of the last record appended
+    uint64_t append(journal_record);
+    uint64_t append_text(rec_op, uint32_t, const char*, size_t);
+    uint64_t last_seq();
+    // drops every record once a snapshot holds what they say, which also
+    // gets over a failed sync. throws if the emptied file cannot be synced
+    void reset();
+    // renames the file and goes on in a new one, numbering included. the
+    // commit thread syncs and closes the old one, records in it count as
+    // synced once it did
+    void rotate(const std::string&);
+    // records in the file
+    size_t records();
+    // gets a copy of every record appended from then on, with the journal
+    // locked. it has to be quick and must not touch the journal. null
+    // removes it
+    void tap(std::function<void(const journal_record&)>);
+    // blocks until the record is synced as the level asks for. throws if
+    // a sync failed, nothing after the last good one is acknowledged then
+    void commit(uint64_t, durability);
+    // the same without blocking, whether the record is synced by now. an
+    // immediate one gets the commit thread going
+    bool committed(uint64_t, durability);
+    // called after every sync, failed ones included, with the journal
+    // locked. it has to be quick and must not touch the journal. null
+    // removes it
+    void on_sync(std::function<void()>);
+    journal_stats stats();
+
+    const std::string& path() const { return path_; }
+
+private:
+    // a file rotate() let go of, with its mapping
+    struct retired_file {
+        int fd;
+        char* base;
+        size_t bytes;
+    };
+
+    void map(size_t);
+    static char* map_file(int, size_t, const std::string&);
+    journal_record* slot(size_t i) const;
+    void commit_loop();
+
+    std::string path_;
+    int fd_;
+    char* base_;
+    size_t capacity_;  // records
+    uint64_t epoch_;   // changes with every new mapping
+    size_t tail_;      // next free record
+    uint64_t seq_;
+    uint64_t synced_;
+    uint64_t commits_;
+    int error_;     // of a failed sync, it sticks until a reset
+    milliseconds window_;
+    bool urgent_;
+    std::vector<retired_file> retired_;
+    bool done_;
+    std::mutex m_;
+    std::condition_variable commit_cv_;
+    std::condition_variable synced_cv_;
+    std::function<void(const journal_record&)> tap_;
+    std::function<void()> on_sync_;
+    std::thread committer_;
+};
+
+} // namespace spclock
+
+#endif
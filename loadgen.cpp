@@ -0,0 +1,115 @@
+// drives a running daemon over the binary protocol with pipelined adds
+// and stops, reporting throughput and reply latency.
+// usage: clock-loadgen [--socket=path] [--sync=none|batched|immediate]
+//                      [ops] [window] [connections]
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "client.h"
+#include "server.h"
+
+namespace {
+using steady = std::chrono::steady_clock;
+
+// keeps up to window requests in flight, every other one stops a buzzer
+// added earlier so the daemon's pending count stays flat
+void drive(const std::string& path, spclock::durability sync, size_t ops,
+           size_t window, std::vector<double>& latencies) {
+    spclock::client c{path};
+    std::vector<steady::time_point> sent;
+    std::vector<char> is_add;
+    std::vector<size_t> ids;
+    sent.reserve(ops);
+    is_add.reserve(ops);
+    latencies.reserve(ops);
+    size_t queued = 0;
+    while (latencies.size() != ops) {
+        while (queued != ops && c.outstanding() < window) {
+            bool add = queued % 2 == 0 || ids.empty();
+            is_add.push_back(add);
+            if (!add) {
+                c.stop(ids.back());
+                ids.pop_back();
+            } else {
+                c.add(spclock::b_type::timer, spclock::seconds{3600}, "load",
+                      spclock::b_priority::bulk, sync);
+            }
+            sent.push_back(steady::now());
+            ++queued;
+        }
+        auto r = c.next();
+        std::chrono::duration<double, std::micro> lat = steady::now() - sent[r.id - 1];
+        latencies.push_back(lat.count());
+        if (!r.ok)
+            std::cerr << r.error << std::endl;
+        else if (is_add[r.id - 1])
+            ids.push_back(r.value);
+    }
+    // leave nothing behind
+    for (auto id:ids)
+        c.stop(id);
+    while (c.outstanding())
+        c.next();
+}
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::string path = spclock::default_socket();
+    auto sync = spclock::durability::none;
+    while (!args.empty() && args[0].compare(0, 2, "--") == 0) {
+        auto eq = args[0].find('=');
+        auto key = args[0].substr(2, eq - 2);
+        auto val = (eq == std::string::npos) ? "" : args[0].substr(eq + 1);
+        if (key == "socket") {
+            path = val;
+        } else if (key == "sync") {
+            sync = spclock::parse_durability(val);
+        } else {
+            std::cout << "Unknown option: " << args[0] << std::endl;
+            return 1;
+        }
+        args.erase(args.begin());
+    }
+    size_t ops = (args.size() > 0) ? std::stoul(args[0]) : 100000;
+    size_t window = (args.size() > 1) ? std::stoul(args[1]) : 256;
+    size_t conns = (args.size() > 2) ? std::stoul(args[2]) : 4;
+
+    std::vector<std::vector<double>> lat(conns);
+    std::vector<std::thread> threads;
+    std::mutex m;
+    bool failed = false;
+    auto start = steady::now();
+    for (size_t i = 0; i != conns; ++i) {
+        threads.emplace_back([&, i] {
+            try {
+                drive(path, sync, ops / conns, window, lat[i]);
+            } catch (std::exception& e) {
+                std::lock_guard<std::mutex> lck(m);
+                std::cout << e.what() << std::endl;
+                failed = true;
+            }
+        });
+    }
+    for (auto& t:threads)
+        t.join();
+    std::chrono::duration<double> elapsed = steady::now() - start;
+    if (failed)
+        return 1;
+
+    std::vector<double> all;
+    for (auto& l:lat)
+        all.insert(all.end(), l.begin(), l.end());
+    if (all.empty())
+        return 0;
+    std::sort(all.begin(), all.end());
+    auto pct = [&](double p) { return all[static_cast<size_t>(p * (all.size() - 1))]; };
+    std::cout << all.size() << " ops over " << conns << " connections in "
+              << elapsed.count() << " s, " << all.size() / elapsed.count()
+              << " ops/s\nlatency us: p50 " << pct(0.5) << ", p99 "
+              << pct(0.99) << ", max " << all.back() << std::endl;
+}
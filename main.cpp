@@ -3,248 +3,1575 @@
 #include <iomanip>
 #include <thread>
 #include <mutex>
-#include <future>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 #include "spclock.h"
+#include "scheduler.h"
+#include "journal.h"
+#include "server.h"
+#include "protocol.h"
+#include "status.h"
+#include "events.h"
+#include "replica.h"
 #include "parse.h"
+#include "command.h"
+#include "script.h"
+#include "render.h"
+#include "notify.h"
+#include "eventlog.h"
 
-std::vector<spclock::buzzer> buzzers;
-std::vector<std::thread> sleeps;
-std::mutex buzz_m;
-std::mutex vec_m;
-int current_buzz_ID;
-
-template <typename T>
-void mut_push_back(std::vector<T>& vec, T&& item) {
-    std::lock_guard<std::mutex> lck(vec_m);
-    vec.push_back(std::forward<T>(item));
-}
-
-void print_info(const std::vector<spclock::buzzer>& buzzers) {
-    using std::stringstream;
-    using std::string;
-    std::unique_lock<std::mutex> lck{vec_m};
-
-    constexpr int ID_width{5};
-    constexpr int time_width{12};
-    constexpr int t_toFin_width{34};
-    constexpr int message_width{40};
-    
-    string edge{'+' + string(ID_width + 1, '-') +
-                '+' + string(time_width + 1, '-') + 
-                '+' + string(t_toFin_width + 1, '-') + 
-                '+' + string(message_width + 1, '-') + '+'};
-
-    std::cout << '\n' << edge << '\n'
-              << '|' << std::setw(ID_width) << "ID" << " |"
-              << std::setw(time_width) << "Finish Time" <<" |"
-              << std::setw(t_toFin_width) << "Time to finish" << " |"
-              << std::setw(message_width) << "Message" << " |"
-              << '\n' << edge << '\n';
-
-    auto now = spclock::now();
-    for (int i=0; i!=buzzers.size(); ++i) {
-        if (buzzers[i].state == spclock::b_state::running) {
-            string out_message = buzzers[i].message;
-            if (out_message.size() > message_width) {
-                out_message = out_message.substr(0, message_width - 3) + "...";
-            }
-            std::cout << "|" 
-              << std::setw(ID_width) << i << " |"
-              << std::setw(time_width) << buzzers[i].end_time.format("%H:%M:%S")
-              << " |"
-              << std::setw(t_toFin_width) << buzzers[i].end_time - now << " |"
-              << std::setw(message_width) << out_message << " |"
-              << '\n';
-        }
+spclock::sched_options sched_opts;
+std::string journal_path;
+std::chrono::milliseconds commit_window{10};
+// a namespace of buzzers with IDs, limits, journal and subscribers of its
+// own. a daemon serves several, everything else only the default one
+struct tenant {
+    std::string name;
+    std::unique_ptr<spclock::journal> jrnl;
+    std::unique_ptr<spclock::event_hub> hub;
+    std::unique_ptr<spclock::scheduler> sched;
+};
+std::unordered_map<std::string, std::unique_ptr<tenant>> tenants;
+tenant* home = nullptr;     // the default namespace
+tenant* current = nullptr;  // the one commands go to
+size_t ns_max_pending = 0;  // limits of namespaces other than the default
+size_t ns_max_bytes = 0;
+// clients cannot create more than this, zero means unlimited
+size_t max_namespaces = 64;
+
+// a fired batch and the namespace its IDs belong to
+struct ringing {
+    tenant* owner;
+    spclock::fire_batch batch;
+};
+std::deque<ringing> ring_queue;
+std::mutex ring_m;
+std::condition_variable ring_cv;
+bool quitting = false;
+// set when commands come from daemon clients instead of the terminal
+bool serving = false;
+bool use_socket = false;
+std::string socket_path;
+std::unique_ptr<spclock::server> srv;
+// how synced the changes a daemon client's command made have to be
+// before it gets the reply, none if nothing asked
+spclock::durability reply_sync = spclock::durability::none;
+spclock::lag_policy slow_subscriber = spclock::lag_policy::mark;
+std::string replicate_path;  // where followers connect
+std::string follow_path;     // the leader of a standby daemon
+std::chrono::milliseconds failover{1000};
+std::unique_ptr<spclock::replicator> repl;
+// sinks from --notify, the bell if there is none and no daemon
+std::string notify_spec;
+std::unique_ptr<spclock::notifier> notifications;
+std::string event_log_path;
+spclock::log_format event_log_format = spclock::log_format::json;
+std::unique_ptr<spclock::event_log> events;
+bool use_status = false;
+std::string status_name;
+std::unique_ptr<spclock::status_page> status;
+
+// the whole of s in as few writes as the terminal takes
+void write_out(std::ostream& out, const std::string& s) {
+    if (&out != &std::cout) {
+        out.write(s.data(), s.size());
+        return;
+    }
+    std::cout.flush();
+    for (size_t off = 0; off != s.size(); ) {
+        auto n = ::write(STDOUT_FILENO, s.data() + off, s.size() - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        off += n;
+    }
+}
+
+// lists running and ringing buzzers, only those due within the given
+// time if it is not zero. the table is rendered into one buffer, sized
+// up front for every pending buzzer, and written in one go
+void print_info(const spclock::scheduler& sched, spclock::seconds within,
+                std::ostream& out) {
+    auto now = date::floor<spclock::seconds>(spclock::current_clock().now());
+    auto to = date::sys_seconds::max();
+    if (within.count() > 0)
+        to = now + within + spclock::seconds{1};
+    spclock::list_renderer render{now};
+    std::string text;
+    text.reserve((sched.stats().pending + 6) * render.line_size);
+    text += '\n';
+    render.edge(text);
+    render.header(text);
+    render.edge(text);
+    sched.visit_active([&](const spclock::buzzer_view& b) {
+        render.row(text, b);
+    }, date::sys_seconds::min(), to);
+    render.edge(text);
+    write_out(out, text);
+}
+
+void print_stats(const tenant& t, std::ostream& out) {
+    auto st = t.sched->stats();
+    out << "pending:  " << st.pending << " (headroom "
+              << st.pending_headroom << ")\n"
+              << "bytes:    " << st.pending_bytes << " (headroom "
+              << st.bytes_headroom << ")\n"
+              << "rate:     " << st.rate_headroom << " inserts available\n"
+              << "admitted: " << st.admitted << ", rejected: " << st.rejected << "\n"
+              << "messages: " << st.message_bytes << " bytes interned, "
+              << st.arena_bytes << " in the arena" << std::endl;
+    if (t.jrnl) {
+        auto js = t.jrnl->stats();
+        out << "journal:  " << js.appended << " records, " << js.synced
+                  << " synced in " << js.commits << " commits" << std::endl;
+        out << "snapshot: " << st.snapshots << " taken, "
+                  << st.snapshot_failures << " failed, last "
+                  << st.snapshot_bytes << " bytes in " << st.snapshot_ms
+                  << " ms, " << st.cow_faults << " copy on write faults ("
+                  << st.child_faults << " in the child)" << std::endl;
+    }
+    if (repl) {
+        auto rs = repl->stats(t.name);
+        out << "replicas: " << rs.followers << ", lag " << rs.lag_records
+            << " records, " << rs.lag_seconds << " s" << std::endl;
     }
-    
-    std::cout << edge << std::endl;
+    if (!notifications->empty())
+        out << "notify:   " << notifications->dropped() << " dropped" << std::endl;
+    if (events)
+        out << "events:   " << events->written() << " written, "
+            << events->dropped() << " dropped" << std::endl;
 }
 
-void print_arg_err() {
-    std::cout << "Argument error." 
-    << "\nUsage: alarm|timer|calc|now|quit <time> [message] "
+void print_arg_err(std::ostream& out = std::cout) {
+    out << "Argument error." 
+    << "\nUsage: [options] alarm|timer|calc|now|list|stats|quit <time> [message] "
+    << "\n       list [--watch] [within] | snapshot | daemon | status | subscribe [tag]"
+    << "\n       use [namespace] | quota [pending] [bytes]"
+    << "\n       run [--batch=lines] <file>|-"
+    << "\n       stop [ID] | snooze [ID] [time]"
+    << "\n       alarm|timer [--prio=critical|normal|bulk] [--block]"
+    << " [--sync=none|batched|immediate]\n"
+    << "                   [--tag=name] <time> [message]"
+    << "\nOptions: --late=all|latest|drop --max-batch=n --bulk-slack=time"
+    << "\n         --max-pending=n --max-bytes=n --max-rate=n/s"
+    << " --admission=reject|block"
+    << "\n         --scheduler=heap|calendar|radix --journal=path"
+    << "\n         --durability=none|batched|immediate --commit-window=ms"
+    << "\n         --snapshot-every=records"
+    << " --snapshot-mode=background|foreground"
+    << "\n         --socket[=path]  talk to the daemon instead"
+    << "\n         --status[=name]  publish a shared memory status page"
+    << "\n         --slow-subscriber=mark|drop"
+    << "\n         --notify=none|bell,file:path,fd:n,exec:command"
+    << "\n         --event-log=path --event-log-format=json|binary"
+    << "\n         --ns-max-pending=n --ns-max-bytes=n  for other namespaces"
+    << "\n         --max-namespaces=n  that clients may create, 64 by default"
+    << "\n         --replicate=path  let standby daemons follow this one"
+    << "\n         --follow=path --failover-after=ms  be a standby daemon"
     << std::endl;
 }
 
-void calc_time(const std::string& str) {
+// command handlers get their arguments parsed according to the command
+// table further down
+
+void print_now(const spclock::command_line&, const spclock::command_args&,
+               std::ostream& out) {
+    out << spclock::now() << std::endl;
+}
+
+void calc_time(const spclock::command_line&, const spclock::command_args& args,
+               std::ostream& out) {
+    out << spclock::now() + args[0].time << std::endl;
+}
+
+// a fired batch rings as one notification until it is stopped
+void on_fire(tenant& t, spclock::fire_batch batch) {
+    if (batch.overdue > 0) {
+        char buf[spclock::max_duration_chars];
+        auto end = spclock::format_duration(buf, batch.suspended);
+        std::lock_guard<std::mutex> lck{ring_m};
+        std::cout << '\n' << batch.overdue
+             << " buzzer(s) went off while suspended for "
+             << std::string_view{buf, static_cast<size_t>(end - buf)} << ".\n\n";
+    }
+    if (batch.ids.empty())
+        return;
+    // nobody watches the daemon's terminal, its output is a log
+    if (serving) {
+        std::lock_guard<std::mutex> lck{ring_m};
+        for (auto id:batch.ids) {
+            std::cout << "ID " << id;
+            if (&t != home)
+                std::cout << " in " << t.name;
+            std::cout << " went off." << std::endl;
+        }
+    }
+    // a higher class jumps ahead and rings right away
+    std::lock_guard<std::mutex> lck{ring_m};
+    auto pos = std::find_if(ring_queue.begin(), ring_queue.end(),
+                   [&](const ringing& r) {
+                       return r.batch.priority > batch.priority; });
+    ring_queue.insert(pos, {&t, std::move(batch)});
+    ring_cv.notify_one();
+}
+
+void ring_loop() {
+    using namespace std::chrono;
+    std::unique_lock<std::mutex> lck{ring_m};
+    for (;;) {
+        ring_cv.wait(lck, []{ return quitting || !ring_queue.empty(); });
+        if (quitting)
+            return;
+        notifications->remind();
+        ring_cv.wait_for(lck, milliseconds{500});
+    }
+}
+
+// takes the first ringing batch of the current namespace off the queue.
+// returns its IDs, none if nothing of it rings. ring_m has to be held
+std::vector<size_t> pop_ringing() {
+    auto itr = std::find_if(ring_queue.begin(), ring_queue.end(),
+                   [](const ringing& r) { return r.owner == current; });
+    if (itr == ring_queue.end())
+        return {};
+    auto ids = std::move(itr->batch.ids);
+    ring_queue.erase(itr);
+    return ids;
+}
+
+// the event loop of the daemon does not wait for the disk, the reply to
+// the client does. a change is made with the level this returns
+spclock::durability defer_sync(spclock::durability level) {
+    if (!serving)
+        return level;
+    reply_sync = std::max(reply_sync, level);
+    return spclock::durability::none;
+}
+
+// acknowledges the batch that is currently ringing
+void stop_ringing() {
+    std::vector<size_t> ids;
+    {
+        std::lock_guard<std::mutex> lck{ring_m};
+        ids = pop_ringing();
+    }
+    auto& sched = *current->sched;
+    for (auto id:ids) {
+        try {
+            sched.stop(id, defer_sync(sched.defaults().sync));
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }
+}
+
+// takes a buzzer of the current namespace out of the ringing batches
+void unring(size_t buzzer_ID) {
+    std::lock_guard<std::mutex> lck{ring_m};
+    for (auto& r:ring_queue) {
+        if (r.owner != current)
+            continue;
+        auto& ids = r.batch.ids;
+        ids.erase(std::remove(ids.begin(), ids.end(), buzzer_ID), ids.end());
+    }
+    ring_queue.erase(std::remove_if(ring_queue.begin(), ring_queue.end(),
+                     [](const ringing& r) { return r.batch.ids.empty(); }),
+                     ring_queue.end());
+}
+
+void stop_buzzer(size_t buzzer_ID, std::ostream& out) {
+    spclock::b_state old;
     try {
-        auto sec = spclock::parse_time(str);
-        std::cout << spclock::now() + sec << std::endl;
+        auto& sched = *current->sched;
+        old = sched.stop(buzzer_ID, defer_sync(sched.defaults().sync));
     } catch (std::exception& e) {
-        std::cout << e.what() << std::endl;
+        out << e.what() << std::endl;
+        return;
+    }
+
+    if (old == spclock::b_state::running) {
+        out << "\nID " << buzzer_ID << " is cancelled!\n\n";
+    } else if (old == spclock::b_state::ringing) {
+        unring(buzzer_ID);
+    }
+}
+
+// snooze [time] puts off the ringing batch, snooze <ID> <time> a single
+// buzzer. the time defaults to five minutes
+void snooze_buzzer(const spclock::command_line&, const spclock::command_args& args,
+                   std::ostream& out) {
+    auto sec = args[1].given ? args[1].time : spclock::seconds{5 * 60};
+    std::vector<size_t> ids;
+    if (args[0].given) {
+        ids.push_back(args[0].number);
+        unring(args[0].number);
+    } else {
+        std::lock_guard<std::mutex> lck{ring_m};
+        ids = pop_ringing();
+    }
+    auto& sched = *current->sched;
+    for (auto id:ids) {
+        try {
+            sched.snooze(id, sec, defer_sync(sched.defaults().sync));
+        } catch (std::exception& e) {
+            out << e.what() << std::endl;
+        }
+    }
+}
+
+// an alarm or timer command as a buzzer, with the options that only
+// matter for adding it put into ao. the message is the rest of the line,
+// the only part that gets copied. throws on errors
+spclock::buzzer make_buzzer(const spclock::command_line& cmds,
+                            const spclock::command_args& args,
+                            const date::time_zone* zone, date::sys_seconds now,
+                            spclock::add_options& ao) {
+    auto prio = spclock::b_priority::normal;
+    std::string_view tag;
+    std::string_view key, val;
+    for (auto opt = cmds.begin_options(); opt != cmds.end_options(); ++opt) {
+        spclock::split_option(*opt, key, val);
+        if (key == "prio")
+            prio = spclock::parse_priority(val);
+        else if (key == "block")
+            ao.admit = spclock::admission::block;
+        else if (key == "sync")
+            ao.sync = spclock::parse_durability(val);
+        else if (key == "tag")
+            tag = val;
+        else
+            throw std::invalid_argument("Unknown option: " + std::string{*opt});
     }
+    auto type = (cmds[0] == "alarm") ? spclock::b_type::alarm : spclock::b_type::timer;
+    spclock::buzzer b(zone, now, args[0].time, type, std::string{args[1].text});
+    b.priority = prio;
+    b.tag = tag;
+    if (b.end_time.sys_time() <= now)
+        throw std::invalid_argument("We cannot go back in time right?");
+    return b;
 }
 
-std::vector<std::string> get_cmds() {
-    using std::string;
-    using std::stringstream;
+void add_buzzer(const spclock::command_line& cmds, const spclock::command_args& args,
+                std::ostream& out) {
+    auto ao = current->sched->defaults();
+    auto now = date::floor<spclock::seconds>(spclock::current_clock().now());
+    try {
+        auto b = make_buzzer(cmds, args, date::current_zone(), now, ao);
+        // the daemon's event loop cannot wait for room
+        if (serving)
+            ao.admit = spclock::admission::reject;
+        ao.sync = defer_sync(ao.sync);
+        current->sched->add(std::move(b), ao);
+    } catch (std::exception& e) {
+        out << e.what() << std::endl;
+        return;
+    }
+    out << "\n" << cmds[0] << " is set.\n\n";
+}
 
-    string line;
-    getline(std::cin, line);
-    stringstream ss;
-    ss << line;
-    std::vector<string> cmds;
-    string cmd;
-    while (ss >> cmd) {
-        cmds.push_back(cmd);
+// with a journal pending buzzers outlive the process
+void stop_all() {
+    if (home && !home->jrnl)
+        home->sched->stop_all();
+    {
+        std::lock_guard<std::mutex> lck{ring_m};
+        ring_queue.clear();
+        quitting = true;
     }
+    ring_cv.notify_one();
+}
+
+// quit was run, from the prompt or a script
+bool has_quit() {
+    std::lock_guard<std::mutex> lck{ring_m};
+    return quitting;
+}
 
-    return cmds;
+std::string limit_str(size_t n) {
+    return n ? std::to_string(n) : std::string{"unlimited"};
 }
 
-void stop_buzzer(size_t buzzer_ID, spclock::b_state stop_state) {
-    std::lock_guard<std::mutex> lck(vec_m);
-    if (buzzer_ID > buzzers.size() - 1)
+// quota shows the limits of the current namespace, quota <pending> [bytes]
+// changes them until the clock restarts. zero means unlimited. a daemon
+// client would lift its own limits, the daemon's options set them
+void set_quota(const spclock::command_line&, const spclock::command_args& args,
+               std::ostream& out) {
+    auto& sched = *current->sched;
+    auto st = sched.stats();
+    if (args[0].given && serving) {
+        out << "Quotas of the daemon are set by its options." << std::endl;
         return;
-    if (buzzers[buzzer_ID].state == spclock::b_state::running) {
-        buzzers[buzzer_ID].stop.set_value();
-        buzzers[buzzer_ID].state = stop_state;
     }
+    if (args[0].given) {
+        try {
+            auto bytes = args[1].given ? args[1].number : st.max_bytes;
+            sched.set_limits(args[0].number, bytes);
+        } catch (std::exception& e) {
+            out << e.what() << std::endl;
+            return;
+        }
+        st = sched.stats();
+    }
+    out << current->name << ": " << st.pending << " of "
+        << limit_str(st.max_pending) << " pending, " << st.pending_bytes
+        << " of " << limit_str(st.max_bytes) << " message bytes" << std::endl;
+}
+
+void quit_clock(const spclock::command_line&, const spclock::command_args&,
+                std::ostream& out) {
+    stop_all();
+    out << "Bye.\n";
+}
+
+// stop [ID] cancels a buzzer, without an ID the ringing batch is stopped
+void stop_cmd(const spclock::command_line&, const spclock::command_args& args,
+              std::ostream& out) {
+    if (args[0].given)
+        stop_buzzer(args[0].number, out);
+    else
+        stop_ringing();
+}
+
+// the height of the terminal, 24 lines if it cannot tell
+size_t terminal_lines() {
+    winsize ws;
+    if (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0)
+        return ws.ws_row;
+    return 24;
 }
 
-void I_sleep(size_t buzzer_ID) {
+// redraws the list every second, on the second, until a line is entered.
+// the table takes the screen and as many rows as fit on it
+void watch_list(spclock::seconds within) {
     using namespace std::chrono;
-    auto sec = buzzers[buzzer_ID].end_time - spclock::now();
-    auto ft = buzzers[buzzer_ID].stop.get_future();
-    auto status = ft.wait_for(sec);
-    if (status != std::future_status::ready) {
-        std::unique_lock<std::mutex> lck(buzz_m);
-        current_buzz_ID = buzzer_ID;
-        for (;;) {
-            status = ft.wait_for(milliseconds{500});
-            if (status != std::future_status::ready)
-                spclock::make_sound();
-            else {
-                stop_buzzer(buzzer_ID, spclock::b_state::finished);
-                current_buzz_ID = -1;
-                break;
+    spclock::list_watch watch;
+    std::string frame;
+    for (;;) {
+        auto now = floor<seconds>(spclock::current_clock().now());
+        auto to = date::sys_seconds::max();
+        if (within.count() > 0)
+            to = now + within + seconds{1};
+        // the edges, the header, and a line for how many more there are
+        auto lines = terminal_lines();
+        watch.begin(now, lines > 7 ? lines - 6 : 1);
+        current->sched->visit_active([&](const spclock::buzzer_view& b) {
+            watch.row(b);
+        }, date::sys_seconds::min(), to);
+        frame.clear();
+        watch.end(frame);
+        write_out(std::cout, frame);
+
+        auto into = spclock::current_clock().now().time_since_epoch() % seconds{1};
+        pollfd pfd{STDIN_FILENO, POLLIN, 0};
+        auto r = ::poll(&pfd, 1, static_cast<int>(duration_cast<milliseconds>(
+                                     seconds{1} - into).count()) + 1);
+        if (r < 0 && errno != EINTR)
+            break;
+        if (r > 0) {
+            std::string ignored;
+            std::getline(std::cin, ignored);
+            break;
+        }
+    }
+    frame.clear();
+    watch.close(frame);
+    write_out(std::cout, frame);
+}
+
+// list [--watch] [within]
+void list_buzzers(const spclock::command_line& cmds, const spclock::command_args& args,
+                  std::ostream& out) {
+    bool watch = false;
+    for (auto opt = cmds.begin_options(); opt != cmds.end_options(); ++opt) {
+        if (*opt != "--watch") {
+            out << "Unknown option: " << *opt << std::endl;
+            return;
+        }
+        watch = true;
+    }
+    if (!watch) {
+        print_info(*current->sched, args[0].time, out);
+        return;
+    }
+    // the daemon has no terminal of the client's to draw on
+    if (serving || &out != &std::cout) {
+        out << "Watching needs a terminal." << std::endl;
+        return;
+    }
+    watch_list(args[0].time);
+}
+
+void stats_cmd(const spclock::command_line&, const spclock::command_args&,
+               std::ostream& out) {
+    print_stats(*current, out);
+}
+
+void snapshot_cmd(const spclock::command_line&, const spclock::command_args&,
+                  std::ostream& out) {
+    try {
+        auto bytes = current->sched->snapshot();
+        if (bytes)
+            out << "Snapshot of " << bytes << " bytes written." << std::endl;
+        else
+            out << "Snapshot is written in the background." << std::endl;
+    } catch (std::exception& e) {
+        out << e.what() << std::endl;
+    }
+}
+
+void run_script(const spclock::command_line&, const spclock::command_args&,
+                std::ostream&);
+
+// every command there is with the arguments it takes. a new one only
+// needs a line here
+using spclock::arg_type;
+constexpr spclock::command_spec command_specs[] = {
+    {"now", print_now},
+    {"calc", calc_time, 1, 1, {arg_type::time}},
+    {"alarm", add_buzzer, 1, 2, {arg_type::time, arg_type::text}, true},
+    {"timer", add_buzzer, 1, 2, {arg_type::time, arg_type::text}, true},
+    {"quit", quit_clock},
+    {"stop", stop_cmd, 0, 1, {arg_type::number}},
+    {"snooze", snooze_buzzer, 0, 2, {arg_type::number, arg_type::time}, false, true},
+    {"list", list_buzzers, 0, 1, {arg_type::time}, true},
+    {"stats", stats_cmd},
+    {"quota", set_quota, 0, 2, {arg_type::number, arg_type::number}},
+    {"run", run_script, 1, 1, {arg_type::text}, true},
+    {"snapshot", snapshot_cmd},
+};
+constexpr auto commands = spclock::make_command_table<32>(command_specs);
+
+// the handler never sees arguments that do not fit its command
+void exec_cmds(const spclock::command_line& cmds, std::ostream& out = std::cout) {
+    auto spec = commands.find(cmds[0]);
+    spclock::command_args args;
+    try {
+        if (!spec || !spclock::parse_args(*spec, cmds, args)) {
+            print_arg_err(out);
+            return;
+        }
+    } catch (std::exception& e) {
+        out << e.what() << std::endl;
+        return;
+    }
+    spec->handler(cmds, args, out);
+}
+
+// what a batch of script lines came to
+struct batch_result {
+    size_t lines = 0;
+    size_t set = 0;
+    size_t failed = 0;
+    spclock::durability level = spclock::durability::none;
+    bool quit = false;
+};
+
+// --batch=lines of run, 4096 without it
+size_t batch_option(const spclock::command_line& cmds) {
+    size_t ret = 4096;
+    std::string_view key, val;
+    for (auto opt = cmds.begin_options(); opt != cmds.end_options(); ++opt) {
+        spclock::split_option(*opt, key, val);
+        if (key != "batch")
+            throw std::invalid_argument("Unknown option: " + std::string{*opt});
+        ret = spclock::parse_number(val);
+        if (!ret)
+            throw std::invalid_argument("A batch needs at least one line.");
+    }
+    return ret;
+}
+
+// runs the next lines of a script, up to max of them that are not blank
+// or comments. the adds go to the scheduler in one handoff, everything
+// else runs as if typed. line numbers count from the one after skipped.
+// the disk is left to the caller, the level it has to wait for comes
+// back. quit ends the batch
+batch_result run_batch(spclock::line_reader& lines, size_t max, size_t skipped,
+                       std::ostream& out) {
+    batch_result ret;
+    auto sched = current->sched.get();
+    auto now = date::floor<spclock::seconds>(spclock::current_clock().now());
+    auto zone = date::current_zone();
+    std::vector<spclock::buzzer> adds;
+    std::vector<size_t> numbers;    // line of every add
+    std::vector<spclock::durability> levels;
+    std::string_view line;
+    auto run_adds = [&] {
+        if (adds.empty())
+            return;
+        auto res = sched->add_batch(std::move(adds), spclock::durability::none);
+        for (size_t i = 0; i != res.size(); ++i) {
+            if (res[i].error.empty()) {
+                ++ret.set;
+                ret.level = std::max(ret.level, levels[i]);
+            } else {
+                ++ret.failed;
+                out << "line " << numbers[i] << ": " << res[i].error << '\n';
             }
         }
-    } else {
-        stop_buzzer(buzzer_ID, spclock::b_state::cancelled);
-        std::lock_guard<std::mutex> lck{buzz_m};
-        std::cout << "\nID " << buzzer_ID
-             << " is cancelled!\n\n"; // ...this has to be done better..
+        adds.clear();
+        numbers.clear();
+        levels.clear();
+    };
+    while (ret.lines != max && lines.next(line)) {
+        spclock::command_line next{line};
+        if (next.empty() || next[0][0] == '#')
+            continue;
+        ++ret.lines;
+        auto number = skipped + lines.number();
+        auto spec = commands.find(next[0]);
+        if (spec && spec->handler == add_buzzer) {
+            auto ao = sched->defaults();
+            spclock::command_args add_args;
+            try {
+                if (!spclock::parse_args(*spec, next, add_args))
+                    throw std::invalid_argument("Argument error.");
+                auto b = make_buzzer(next, add_args, zone, now, ao);
+                // a batch only ever rejects, the daemon never blocks
+                if (ao.admit == spclock::admission::block && !serving) {
+                    run_adds();
+                    auto level = ao.sync;
+                    ao.sync = spclock::durability::none;
+                    sched->add(std::move(b), ao);
+                    ++ret.set;
+                    ret.level = std::max(ret.level, level);
+                    continue;
+                }
+                adds.push_back(std::move(b));
+                numbers.push_back(number);
+                levels.push_back(ao.sync);
+            } catch (std::exception& e) {
+                ++ret.failed;
+                out << "line " << number << ": " << e.what() << '\n';
+            }
+            continue;
+        }
+        // everything before it has to be in first
+        run_adds();
+        if (next[0] == "quit") {
+            ret.quit = true;
+            break;
+        }
+        if (spec && spec->handler == run_script) {
+            ++ret.failed;
+            out << "line " << number << ": Not in a script: " << next[0] << '\n';
+            continue;
+        }
+        exec_cmds(next, out);
     }
+    run_adds();
+    return ret;
+}
+
+std::string batch_report(size_t number, const batch_result& r, double ms) {
+    std::ostringstream report;
+    report << "batch " << number << ": " << r.lines << " lines, " << r.set
+           << " set, " << r.failed << " failed, " << std::fixed
+           << std::setprecision(2) << ms << " ms\n";
+    return report.str();
+}
+
+std::string script_report(size_t lines, size_t set, size_t failed, double ms) {
+    std::ostringstream report;
+    report << lines << " lines, " << set << " set, " << failed << " failed in "
+           << std::fixed << std::setprecision(2) << ms << " ms";
+    if (ms > 0)
+        report << ", " << std::setprecision(0) << lines * 1000 / ms << " lines/s";
+    report << '\n';
+    return report.str();
 }
 
-void add_buzzer(const std::vector<std::string>& cmds) {
-    spclock::seconds sec;
+// run [--batch=lines] <file>|- runs a file of commands, one per line.
+// the adds of a batch of lines go to the scheduler in one handoff and the
+// disk is waited for once per batch, everything else runs as if typed.
+// an add that blocks for room goes in on its own. how long each batch
+// took is reported. quit ends the script and the clock. the daemon would
+// run it between the lines of its other clients, a client sends it the
+// lines in batches instead
+void run_script(const spclock::command_line& cmds, const spclock::command_args& args,
+                std::ostream& out) {
+    using clk = std::chrono::steady_clock;
+    size_t batch_lines;
+    std::unique_ptr<spclock::script_file> file;
     try {
-        sec = spclock::parse_time(cmds[1]);
+        batch_lines = batch_option(cmds);
+        if (serving)
+            throw std::invalid_argument("The daemon does not run scripts, its clients do.");
+        file.reset(new spclock::script_file(std::string{args[0].text}));
     } catch (std::exception& e) {
-        std::cout << e.what() << std::endl;
-        return ;
+        out << e.what() << std::endl;
+        return;
     }
-    std::string msg;
-    if (cmds.size() < 3) {
-        msg = "";
-    } else {
-        msg = cmds[2];
-    }
-    spclock::buzzer b(sec, cmds[0], msg);
-    if (b.end_time > spclock::now()) {
-        mut_push_back(buzzers, std::move(b));
-        std::thread t{I_sleep, buzzers.size() - 1};
-        mut_push_back(sleeps, std::move(t));
-        std::cout << "\n" << cmds[0] << " is set.\n\n";
-    } else {
-        std::cout << "We cannot go back in time right?" << std::endl;
+
+    auto sched = current->sched.get();
+    spclock::line_reader lines{file->text()};
+    size_t batch = 0, total = 0, total_set = 0, total_failed = 0;
+    bool quit = false;
+    auto started = clk::now();
+    while (!quit) {
+        auto t0 = clk::now();
+        auto r = run_batch(lines, batch_lines, 0, out);
+        quit = r.quit;
+        if (!r.lines)
+            break;
+        try {
+            sched->sync(r.level);
+        } catch (std::exception& e) {
+            // none of the batch is on disk for sure
+            out << e.what() << '\n';
+            r.failed += r.set;
+            r.set = 0;
+        }
+        std::chrono::duration<double, std::milli> took = clk::now() - t0;
+        out << batch_report(++batch, r, took.count());
+        total += r.lines;
+        total_set += r.set;
+        total_failed += r.failed;
     }
+    std::chrono::duration<double, std::milli> took = clk::now() - started;
+    out << script_report(total, total_set, total_failed, took.count()) << std::flush;
+    if (quit && !serving)
+        exec_cmds(spclock::command_line{"quit"}, out);
 }
 
-void stop_all() {
-    for (size_t i = 0; i < buzzers.size(); ++i) {
-        stop_buzzer(i, spclock::b_state::cancelled);
+// namespace names end up in journal file names
+bool valid_namespace(const std::string& name) {
+    if (name.empty() || name.size() > 32)
+        return false;
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+    });
+}
+
+// subscribers of a namespace only hear of its own buzzers
+// buzzer events go to the subscribers of a daemon and to the notifiers
+void watch(tenant& t) {
+    std::unique_ptr<spclock::event_hub> fresh;
+    if (srv) {
+        fresh.reset(new spclock::event_hub([] { srv->poke(); }, slow_subscriber));
+        // replies held for the disk go out
+        if (t.jrnl)
+            t.jrnl->on_sync([] { srv->poke(); });
+    }
+    auto hub = fresh.get();
+    auto sinks = notifications.get();
+    if (hub || !sinks->empty()) {
+        auto space = &t.name;
+        t.sched->observe([hub, sinks, space](const spclock::sched_event& ev) {
+            if (hub)
+                hub->publish(ev);
+            sinks->notify(*space, ev);
+        });
+    }
+    // the old observer is gone by now, so is the last use of its hub
+    if (fresh)
+        t.hub = std::move(fresh);
+}
+
+// --notify=bell,file:<path>,fd:<n>,exec:<command>. the command takes the
+// rest, commas and all
+void open_notifications(bool daemon) {
+    notifications.reset(new spclock::notifier);
+    auto spec = notify_spec.empty() ? std::string{daemon ? "none" : "bell"} : notify_spec;
+    if (spec == "none")
+        return;
+    for (size_t pos = 0; pos <= spec.size(); ) {
+        auto comma = spec.compare(pos, 5, "exec:") == 0 ? std::string::npos
+                                                        : spec.find(',', pos);
+        if (comma == std::string::npos)
+            comma = spec.size();
+        notifications->add(spclock::make_sink(spec.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+}
+
+std::string journal_of(const std::string& name) {
+    return (name == "default") ? journal_path : journal_path + '@' + name;
+}
+
+spclock::sched_options options_of(const std::string& name) {
+    auto opts = sched_opts;
+    if (name != "default") {
+        if (ns_max_pending)
+            opts.max_pending = ns_max_pending;
+        if (ns_max_bytes)
+            opts.max_bytes = ns_max_bytes;
     }
+    return opts;
+}
 
-    for (auto& t:sleeps) {
-        if (t.joinable())
-            t.join();
+// creates a namespace and loads what its journal holds. the default one
+// has the journal given by --journal, the others journal@name and the
+// --ns-max-* limits if there are any. throws if the journal cannot be read.
+// a standby daemon recovers from its leader instead of its own journal
+tenant* open_tenant(const std::string& name, bool recover = true) {
+    std::unique_ptr<tenant> t{new tenant};
+    t->name = name;
+    auto opts = options_of(name);
+    auto path = journal_of(name);
+    auto raw = t.get();
+    t->sched.reset(new spclock::scheduler(
+        [raw](spclock::fire_batch b) { on_fire(*raw, std::move(b)); }, opts));
+    if (!journal_path.empty() && recover) {
+        t->jrnl.reset(new spclock::journal(path, commit_window));
+        t->sched->attach(*t->jrnl, path + ".snap");
     }
+    // what the journal brought back happened before
+    if (events)
+        t->sched->record_to(events.get(), events->space(name));
+    watch(*t);
+    if (repl && t->jrnl)
+        repl->add(name, *t->sched, *t->jrnl);
+    tenants.emplace(name, std::move(t));
+    return raw;
 }
 
-template <typename Container>
-std::vector<std::string> modify_cmds(const Container& cmds) {
-    using namespace std;
-    if (cmds.size() <= 2) {
-        //arguments passed in doesn't involve message
-        return cmds;
+// brings back the namespaces that have a journal next to the default one,
+// so their buzzers go off without anybody using them first
+void load_tenants() {
+    if (journal_path.empty())
+        return;
+    auto slash = journal_path.rfind('/');
+    auto dir = (slash == std::string::npos) ? std::string{"."} :
+               journal_path.substr(0, slash + 1);
+    auto prefix = journal_path.substr(slash + 1) + '@';
+    std::vector<std::string> names;
+    if (DIR* d = ::opendir(dir.c_str())) {
+        while (auto e = ::readdir(d)) {
+            std::string file{e->d_name};
+            if (file.compare(0, prefix.size(), prefix) != 0)
+                continue;
+            auto name = file.substr(prefix.size());
+            // snapshots and rotated journals have a dot in the name
+            if (valid_namespace(name) && !tenants.count(name))
+                names.push_back(name);
+        }
+        ::closedir(d);
     }
-    
-    // args with message info.
-    if ((cmds[0] == "alarm") || (cmds[0] == "timer")) {
-        vector<string> ret;
-        for (int i=0; i<2; ++i) {
-            ret.push_back(cmds[i]);
+    for (auto& name:names) {
+        try {
+            open_tenant(name);
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
         }
-        string msg;
-        for (int i=2; i<cmds.size(); ++i) {
-            msg += " " + cmds[i];
+    }
+}
+
+// switches the connection to the namespace and creates it if it is new.
+// returns what went wrong, empty if nothing did
+std::string enter_tenant(const std::string& name, spclock::session& s) {
+    if (!valid_namespace(name))
+        return "Not a valid namespace name: " + name;
+    if (!tenants.count(name)) {
+        // every one has a thread and a journal of its own
+        if (max_namespaces && tenants.size() >= max_namespaces)
+            return "No more namespaces, there are " + std::to_string(tenants.size()) +
+                   " already.";
+        try {
+            open_tenant(name);
+        } catch (std::exception& e) {
+            return e.what();
         }
-        ret.push_back(msg);
+    }
+    s.scope = name;
+    return std::string{};
+}
 
-        return ret;
-    } else {
-        return cmds;
+// use shows the namespaces, use <name> switches the connection to one
+// and creates it if it is new
+void use_tenant(const spclock::command_line& cmds, spclock::session& s,
+                std::ostream& out) {
+    if (cmds.size() == 1) {
+        out << "Using " << current->name << ", namespaces:";
+        for (auto& t:tenants)
+            out << ' ' << t.first;
+        out << std::endl;
+        return;
+    }
+    std::string name{cmds[1]};
+    auto err = enter_tenant(name, s);
+    if (!err.empty()) {
+        out << err << std::endl;
+        return;
     }
+    out << "Using " << name << "." << std::endl;
 }
 
-template <typename Container>
-void exec_cmds(const Container& cmds_in) {
-    auto cmds = modify_cmds(cmds_in);
-    if (cmds[0] == "now") {
-        std::cout << spclock::now() << std::endl;
+// the totals of the script go out behind its last batch, then what after
+// holds
+void end_script(spclock::session& s, const std::string& after) {
+    using clk = std::chrono::steady_clock;
+    auto totals = std::move(s.script);
+    s.held.push_back({[totals, after](std::string& text) {
+        std::chrono::duration<double, std::milli> took = clk::now() - totals->started;
+        text += script_report(totals->lines, totals->set, totals->failed, took.count());
+        text += after;
+        return true;
+    }, std::string{}});
+}
 
-    } else if (cmds[0] == "calc") {
-        calc_time(cmds[1]);
+// batch <lines> <skipped> has the lines after it collected and run as a
+// batch of a script, skipped is how many lines of the script came before
+// them. batch alone ends the script
+void start_batch(const spclock::command_line& cmds, spclock::session& s) {
+    if (cmds.size() == 1 && s.script) {
+        end_script(s, std::string{});
+        return;
+    }
+    size_t lines = 0, skipped = 0;
+    try {
+        if (cmds.size() == 3) {
+            lines = spclock::parse_number(cmds[1]);
+            skipped = spclock::parse_number(cmds[2]);
+        }
+    } catch (std::exception&) {
+        lines = 0;
+    }
+    if (!lines) {
+        std::ostringstream out;
+        print_arg_err(out);
+        s.out += out.str();
+        return;
+    }
+    if (!s.script) {
+        s.script = std::make_shared<spclock::script_totals>();
+        s.script->started = std::chrono::steady_clock::now();
+    }
+    s.batch.clear();
+    s.batch_left = lines;
+    s.batch_skipped = skipped;
+}
 
-    } else if ((cmds[0] == "alarm") || (cmds[0] == "timer")) {
-        add_buzzer(cmds);
-    
-    } else if (cmds[0] == "quit") {
-        stop_all();
-        std::cout << "Bye.\n";
-
-    } else if (cmds[0] == "stop") {
-        if (cmds.size() > 1) {
-            std::stringstream ss;
-            ss << cmds[1];
-            size_t idx;
-            ss >> idx;
-            stop_buzzer(idx, spclock::b_state::cancelled);
-        } else {
-            if (current_buzz_ID >= 0) 
-                stop_buzzer(current_buzz_ID, spclock::b_state::cancelled);
-        }
-    } else if (cmds[0] == "list") {
-        print_info(buzzers);
+// runs the batch collected like run does. its reply waits for the disk,
+// not the event loop, and the report says how long that took. quit ends
+// the script and the connection
+bool serve_batch(spclock::session& s) {
+    using clk = std::chrono::steady_clock;
+    auto t0 = clk::now();
+    auto itr = tenants.find(s.scope);
+    current = (itr == tenants.end()) ? home : itr->second.get();
+    std::ostringstream out;
+    reply_sync = spclock::durability::none;
+    spclock::line_reader lines{s.batch};
+    auto r = run_batch(lines, SIZE_MAX, s.batch_skipped, out);
+    s.batch.clear();
+    r.level = std::max(r.level, reply_sync);
+    auto sched = current->sched.get();
+    auto seq = sched->last_logged();
+    auto totals = s.script;
+    s.held.push_back({[sched, seq, r, t0, totals](std::string& text) mutable {
+        try {
+            if (r.level != spclock::durability::none && !sched->is_durable(seq, r.level))
+                return false;
+        } catch (std::exception& e) {
+            // none of the batch is on disk for sure
+            text += std::string{e.what()} + "\n";
+            r.failed += r.set;
+            r.set = 0;
+        }
+        if (!r.lines)
+            return true;
+        std::chrono::duration<double, std::milli> took = clk::now() - t0;
+        text += batch_report(++totals->batches, r, took.count());
+        totals->lines += r.lines;
+        totals->set += r.set;
+        totals->failed += r.failed;
+        return true;
+    }, out.str()});
+    if (!r.quit)
+        return true;
+    end_script(s, "Bye.\n");
+    return false;
+}
 
-    } else {
-        print_arg_err();
+// a line from a daemon client. quit only ends that client's connection,
+// subscribe turns it into a stream of buzzer events. commands go to the
+// namespace the connection uses
+bool serve_line(const std::string& line, spclock::session& s) {
+    if (s.batch_left) {
+        s.batch += line;
+        s.batch += '\n';
+        return --s.batch_left ? true : serve_batch(s);
+    }
+    auto& reply = s.out;
+    spclock::command_line cmds{line};
+    if (cmds.empty())
+        return true;
+    if (cmds[0] == "batch") {
+        start_batch(cmds, s);
+        return true;
+    }
+    auto itr = tenants.find(s.scope);
+    current = (itr == tenants.end()) ? home : itr->second.get();
+    if (cmds[0] == "quit") {
+        reply += "Bye.\n";
+        return false;
+    }
+    if (cmds[0] == "use" && cmds.size() < 3) {
+        std::ostringstream out;
+        use_tenant(cmds, s, out);
+        reply += out.str();
+        return true;
+    }
+    if (cmds[0] == "subscribe") {
+        if (cmds.size() > 2 || s.feed) {
+            std::ostringstream out;
+            print_arg_err(out);
+            reply += out.str();
+            return true;
+        }
+        auto hub = current->hub.get();
+        auto sub = hub->subscribe(std::string{cmds.size() > 1 ? cmds[1] : ""});
+        s.feed = [hub, sub](std::string& out) { return hub->drain(*sub, out); };
+        reply += "Subscribed.\n";
+        return true;
+    }
+    std::ostringstream out;
+    reply_sync = spclock::durability::none;
+    try {
+        if (cmds[0] == "daemon")
+            print_arg_err(out);
+        else
+            exec_cmds(cmds, out);
+    } catch (std::exception& e) {
+        out << e.what() << std::endl;
+    }
+    auto sched = current->sched.get();
+    auto seq = sched->last_logged();
+    auto level = reply_sync;
+    if (level == spclock::durability::none || sched->is_durable(seq, level)) {
+        reply += out.str();
+        return true;
+    }
+    // the journal pokes the server once it synced
+    s.held.push_back({[sched, seq, level](std::string& text) {
+        try {
+            return sched->is_durable(seq, level);
+        } catch (std::exception& e) {
+            text = std::string{e.what()} + "\n";
+            return true;
+        }
+    }, out.str()});
+    return true;
+}
+
+// binary requests that came in together. runs of adds go to the scheduler
+// in one handoff, of the namespace the connection uses like a text one.
+// the replies are held until the disk has all of it, without the event
+// loop waiting
+void serve_frames(const char* data, size_t size, spclock::session& s) {
+    using spclock::durability;
+    auto itr = tenants.find(s.scope);
+    current = (itr == tenants.end()) ? home : itr->second.get();
+    auto sched = current->sched.get();
+    std::vector<spclock::request> reqs;
+    for (size_t off = 0; off != size; ) {
+        reqs.emplace_back();
+        off += spclock::decode(data + off, size - off, reqs.back());
+    }
+    std::vector<spclock::reply> replies(reqs.size());
+    auto level = durability::none;
+    std::vector<spclock::buzzer> adds;
+    std::vector<size_t> slots;  // request index of every add
+    // what each namespace used has to have on disk before the replies go
+    std::vector<std::pair<spclock::scheduler*, uint64_t>> logged;
+    auto now = date::floor<spclock::seconds>(spclock::current_clock().now());
+    auto zone = date::current_zone();
+
+    auto run_adds = [&] {
+        if (adds.empty())
+            return;
+        auto res = sched->add_batch(std::move(adds), durability::none);
+        for (size_t i = 0; i != res.size(); ++i) {
+            auto& rep = replies[slots[i]];
+            rep.ok = res[i].error.empty();
+            rep.value = res[i].id;
+            rep.error = std::move(res[i].error);
+            if (rep.ok)
+                level = std::max(level, static_cast<durability>(reqs[slots[i]].sync));
+        }
+        adds.clear();
+        slots.clear();
+    };
+
+    for (size_t i = 0; i != reqs.size(); ++i) {
+        auto& r = reqs[i];
+        auto& rep = replies[i];
+        rep = {r.id, true, 0, std::string{}};
+        // stop and snooze carry no durability of their own
+        if (r.op != spclock::wire_op::add)
+            run_adds();
+        try {
+            switch (r.op) {
+            case spclock::wire_op::add: {
+                if (r.type > 1 || r.priority > 2 || r.sync > 2)
+                    throw std::invalid_argument("Malformed request");
+                // no further than the text form can say
+                if (r.seconds > spclock::max_time || r.seconds < -spclock::max_time)
+                    throw std::invalid_argument("Time format not valid");
+                spclock::buzzer b(zone, now, spclock::seconds{r.seconds},
+                                  static_cast<spclock::b_type>(r.type),
+                                  std::move(r.message));
+                b.priority = static_cast<spclock::b_priority>(r.priority);
+                b.tag = std::move(r.tag);
+                if (b.end_time.sys_time() <= now)
+                    throw std::invalid_argument("We cannot go back in time right?");
+                adds.push_back(std::move(b));
+                slots.push_back(i);
+                break;
+            }
+            case spclock::wire_op::stop: {
+                level = std::max(level, sched->defaults().sync);
+                auto old = sched->stop(r.buzzer, durability::none);
+                if (old == spclock::b_state::ringing)
+                    unring(r.buzzer);
+                rep.value = static_cast<uint64_t>(old);
+                break;
+            }
+            case spclock::wire_op::snooze: {
+                if (r.seconds > spclock::max_time)
+                    throw std::invalid_argument("Time format not valid");
+                level = std::max(level, sched->defaults().sync);
+                auto old = sched->snooze(r.buzzer, spclock::seconds{r.seconds},
+                                         durability::none);
+                unring(r.buzzer);
+                rep.value = static_cast<uint64_t>(old);
+                break;
+            }
+            case spclock::wire_op::use: {
+                auto err = enter_tenant(r.tag, s);
+                if (!err.empty())
+                    throw std::invalid_argument(err);
+                logged.emplace_back(sched, sched->last_logged());
+                current = tenants.find(s.scope)->second.get();
+                sched = current->sched.get();
+                break;
+            }
+            }
+        } catch (std::exception& e) {
+            rep.ok = false;
+            rep.error = e.what();
+        }
+    }
+    run_adds();
+    logged.emplace_back(sched, sched->last_logged());
+    auto durable = [logged, level] {
+        for (auto& l:logged) {
+            if (!l.first->is_durable(l.second, level))
+                return false;
+        }
+        return true;
+    };
+    std::string out;
+    for (auto& rep:replies)
+        spclock::encode(rep, out);
+    if (level == durability::none || durable()) {
+        s.out += out;
+        return;
+    }
+    // nothing that succeeded is acknowledged after a failed sync
+    s.held.push_back({[durable, replies](std::string& text) mutable {
+        try {
+            return durable();
+        } catch (std::exception& e) {
+            text.clear();
+            for (auto& rep:replies) {
+                if (rep.ok) {
+                    rep.ok = false;
+                    rep.error = e.what();
+                }
+                spclock::encode(rep, text);
+            }
+            return true;
+        }
+    }, std::move(out)});
+}
+
+void on_signal(int) {
+    if (srv)
+        srv->stop();
+}
+
+// serves clients until SIGINT or SIGTERM
+int run_daemon() {
+    try {
+        srv.reset(new spclock::server(socket_path, serve_line, serve_frames));
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    load_tenants();
+    // the ones load_tenants() opened are watched already
+    for (auto& t:tenants)
+        if (!t.second->hub)
+            watch(*t.second);
+    if (!replicate_path.empty()) {
+        try {
+            repl.reset(new spclock::replicator(replicate_path));
+            // the default one goes first, it carries the heartbeat
+            repl->add(home->name, *home->sched, *home->jrnl);
+            for (auto& t:tenants)
+                if (t.second.get() != home)
+                    repl->add(t.first, *t.second->sched, *t.second->jrnl);
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
+            srv.reset();
+            return 1;
+        }
+    }
+    serving = true;
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    std::cout << "Serving on " << socket_path << std::endl;
+    int ret = 0;
+    try {
+        srv->run();
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        ret = 1;
+    }
+    repl.reset();
+    // subscriptions go with their connections, before the hubs
+    for (auto& t:tenants) {
+        t.second->sched->observe(nullptr);
+        if (t.second->jrnl)
+            t.second->jrnl->on_sync(nullptr);
+    }
+    srv.reset();
+    for (auto& t:tenants)
+        t.second->hub.reset();
+    return ret;
+}
+
+// keeps every namespace a copy of the leader's until the leader is gone,
+// then takes over. every snapshot from the leader goes into a new
+// scheduler and the namespace's own journal starts over from it. a leader
+// that hangs with its socket still answering is waited for, not taken
+// over from
+bool run_follower() {
+    bool followed = false, starting = false;
+    auto start = [&](const std::string& name) -> spclock::scheduler& {
+        starting = true;
+        auto itr = tenants.find(name);
+        auto t = (itr != tenants.end()) ? itr->second.get() : open_tenant(name, false);
+        t->sched.reset();
+        t->jrnl.reset();
+        auto path = journal_of(name);
+        ::unlink(path.c_str());
+        ::unlink((path + ".old").c_str());
+        t->jrnl.reset(new spclock::journal(path, commit_window));
+        t->sched.reset(new spclock::scheduler(
+            [t](spclock::fire_batch b) { on_fire(*t, std::move(b)); }, options_of(name)));
+        t->sched->standby(true);
+        t->sched->attach(*t->jrnl, path + ".snap");
+        if (events)
+            t->sched->record_to(events.get(), events->space(name));
+        watch(*t);
+        if (t == home && status)
+            t->sched->publish_to(status.get());
+        std::cout << "Following " << name << " from " << follow_path << std::endl;
+        followed = true;
+        starting = false;
+        return *t->sched;
+    };
+    auto snapshot_of = [](const std::string& name) { return journal_of(name) + ".snap"; };
+    size_t spaces = 0;
+    for (bool told = false; ; told = true) {
+        try {
+            spaces = spclock::follow(follow_path, snapshot_of, start, failover);
+        } catch (std::exception& e) {
+            // not finding the leader again is what waiting for it is about
+            if (!followed || starting) {
+                std::cout << e.what() << std::endl;
+                return false;
+            }
+        }
+        int fd = spclock::connect_socket(socket_path);
+        if (fd < 0)
+            break;
+        ::close(fd);
+        if (!told)
+            std::cout << "The leader stopped replicating but still answers on "
+                      << socket_path << ", waiting for it." << std::endl;
+        std::this_thread::sleep_for(failover);
+    }
+    std::cout << "The leader is gone, taking over " << spaces
+              << (spaces == 1 ? " namespace." : " namespaces.") << std::endl;
+    for (auto& t:tenants)
+        t.second->sched->standby(false);
+    return true;
+}
+
+// reads the page a running clock publishes. neither that clock nor the
+// time zone database gets touched
+int print_status() {
+    spclock::status_data d;
+    try {
+        spclock::status_page page{status_name, false};
+        if (!page.read(d))
+            throw std::runtime_error("The clock publishing " + status_name +
+                                     " stopped halfway through an update.");
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    auto now = std::chrono::duration_cast<spclock::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    std::cout << "pending:  " << d.pending << ", ringing: " << d.ringing
+              << ", fired: " << d.fired << "\n"
+              << "admitted: " << d.admitted << ", rejected: " << d.rejected
+              << "\n";
+    for (uint32_t i = 0; i != d.next_count; ++i) {
+        std::cout << (i ? "          " : "next:     ") << "ID " << d.next_id[i]
+                  << " in " << d.next_deadline[i] - now << "s\n";
+    }
+    if (d.ringing_count) {
+        std::cout << "ringing:  ID";
+        for (uint32_t i = 0; i != d.ringing_count; ++i)
+            std::cout << ' ' << d.ringing_id[i];
+        std::cout << "\n";
+    }
+    std::cout << "updated " << now - d.updated << "s ago" << std::endl;
+    return 0;
+}
+
+// the lines of a script go to the daemon in one go, a batch header in
+// front of every batch of them, and what it answers comes back while they
+// do. it runs a batch as soon as it has all of it
+std::string script_lines(const spclock::command_line& cmds) {
+    spclock::command_args args;
+    if (!spclock::parse_args(*commands.find("run"), cmds, args))
+        throw std::invalid_argument("Argument error.");
+    auto batch_lines = batch_option(cmds);
+    spclock::script_file file{std::string{args[0].text}};
+    spclock::line_reader lines{file.text()};
+    std::string_view line;
+    std::string ret, chunk;
+    size_t raw = 0, counted = 0, skipped = 0;
+    bool quit = false;
+    auto flush = [&] {
+        if (counted)
+            ret += "batch " + std::to_string(raw) + " " + std::to_string(skipped) +
+                   "\n" + chunk;
+        chunk.clear();
+        raw = counted = 0;
+    };
+    while (!quit && lines.next(line)) {
+        if (!raw)
+            skipped = lines.number() - 1;
+        chunk.append(line.data(), line.size());
+        chunk += '\n';
+        ++raw;
+        spclock::command_line next{line};
+        if (next.empty() || next[0][0] == '#')
+            continue;
+        quit = next[0] == "quit";
+        if (++counted == batch_lines || quit)
+            flush();
     }
+    flush();
+    // the daemon closes the connection after a quit
+    if (!quit && !ret.empty())
+        ret += "batch";
+    return ret;
+}
+
+// hands the command over to a running daemon, a script in batches
+int run_client(const std::string& line) {
+    try {
+        spclock::command_line cmds{line};
+        auto req = (cmds[0] == "run") ? script_lines(cmds) : line;
+        if (!req.empty())
+            spclock::call_server(socket_path, req, std::cout);
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// startup options come before the command, e.g. --late=latest
+bool parse_options(std::vector<std::string>& args,
+                   spclock::sched_options& opts) {
+    auto itr = args.begin();
+    for (; itr != args.end() && itr->compare(0, 2, "--") == 0; ++itr) {
+        std::string_view key, v;
+        spclock::split_option(*itr, key, v);
+        std::string val{v};
+        try {
+            if (key == "late") {
+                opts.late = spclock::parse_late_policy(val);
+            } else if (key == "max-batch") {
+                opts.max_batch = std::stoul(val);
+            } else if (key == "bulk-slack") {
+                opts.bulk_slack = spclock::parse_time(val);
+            } else if (key == "max-pending") {
+                opts.max_pending = std::stoul(val);
+            } else if (key == "max-bytes") {
+                opts.max_bytes = std::stoul(val);
+            } else if (key == "max-rate") {
+                opts.max_rate = std::stod(val);
+            } else if (key == "admission") {
+                opts.admit = spclock::parse_admission(val);
+            } else if (key == "scheduler") {
+                opts.backend = spclock::parse_queue_kind(val);
+            } else if (key == "journal") {
+                journal_path = val;
+            } else if (key == "durability") {
+                opts.sync = spclock::parse_durability(val);
+            } else if (key == "snapshot-every") {
+                opts.snapshot_every = std::stoul(val);
+            } else if (key == "snapshot-mode") {
+                opts.snapshots = spclock::parse_snapshot_mode(val);
+            } else if (key == "status") {
+                use_status = true;
+                status_name = val;
+            } else if (key == "socket") {
+                use_socket = true;
+                socket_path = val;
+            } else if (key == "ns-max-pending") {
+                ns_max_pending = std::stoul(val);
+            } else if (key == "ns-max-bytes") {
+                ns_max_bytes = std::stoul(val);
+            } else if (key == "max-namespaces") {
+                max_namespaces = std::stoul(val);
+            } else if (key == "replicate") {
+                replicate_path = val;
+            } else if (key == "follow") {
+                follow_path = val;
+            } else if (key == "failover-after") {
+                failover = std::chrono::milliseconds{std::stoul(val)};
+            } else if (key == "slow-subscriber") {
+                slow_subscriber = spclock::parse_lag_policy(val);
+            } else if (key == "event-log") {
+                event_log_path = val;
+            } else if (key == "event-log-format") {
+                event_log_format = spclock::parse_log_format(val);
+            } else if (key == "notify") {
+                notify_spec = val;
+            } else if (key == "commit-window") {
+                commit_window = std::chrono::milliseconds{std::stoul(val)};
+            } else {
+                std::cout << "Unknown option: " << *itr << std::endl;
+                return false;
+            }
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
+            return false;
+        }
+    }
+    args.erase(args.begin(), itr);
+    return true;
 }
 
 int main(int argc, char **argv){
-    if (argc < 2) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (!parse_options(args, sched_opts) || args.empty()) {
         print_arg_err();
         return 1;
     }
-    
-    std::vector<std::string> cmds(argv + 1, argv + argc);
-    current_buzz_ID = -1;
+    // the command is taken like a line typed at the prompt
+    std::string line;
+    for (auto& a:args) {
+        if (!line.empty())
+            line += ' ';
+        line += a;
+    }
+    spclock::command_line cmds{line};
+    if (socket_path.empty())
+        socket_path = spclock::default_socket();
+    if (status_name.empty())
+        status_name = spclock::default_status_name(socket_path);
+    if (cmds[0] == "status")
+        return print_status();
+    // a client never loads the time zone database, the daemon did
+    if (use_socket && cmds[0] != "daemon")
+        return run_client(line);
+
+    // followers log what the leader sends to their own journal
+    bool standby = !follow_path.empty() && cmds[0] == "daemon";
+    if ((standby || !replicate_path.empty()) && journal_path.empty()) {
+        std::cout << "Replication needs a journal." << std::endl;
+        return 1;
+    }
+    try {
+        open_notifications(cmds[0] == "daemon");
+        if (!event_log_path.empty())
+            events.reset(new spclock::event_log(event_log_path, event_log_format));
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    std::thread ringer{ring_loop};
+    try {
+        home = open_tenant("default", !standby);
+        current = home;
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        stop_all();
+        ringer.join();
+        return 1;
+    }
+    if (use_status) {
+        try {
+            status.reset(new spclock::status_page(status_name, true));
+            home->sched->publish_to(status.get());
+        } catch (std::exception& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }
+    if (cmds[0] == "daemon") {
+        int ret = (!standby || run_follower()) ? run_daemon() : 1;
+        stop_all();
+        ringer.join();
+        tenants.clear();
+        status.reset();
+        notifications.reset();
+        events.reset();
+        return ret;
+    }
+    // recovered buzzers keep the prompt open as well
+    bool pending = home->sched->stats().pending > 0;
     exec_cmds(cmds);
-    if ((cmds[0] == "alarm") || (cmds[0] == "timer")) {
+    // so do the buzzers of a script
+    if (cmds[0] == "run")
+        pending = home->sched->stats().pending > 0;
+    if ((pending || (cmds[0] == "alarm") || (cmds[0] == "timer")) && !has_quit()) {
+        // one buffer for every line, it only grows for a longer one
+        std::string input;
         while (true) {
             std::cout << ">> ";
-            cmds = get_cmds();
-            if (cmds.size() > 0) {
-                exec_cmds(cmds);
-                if (cmds[0] == "quit")
+            // the end of the input quits like the quit command
+            if (!std::getline(std::cin, input))
+                input = "quit";
+            spclock::command_line next{input};
+            if (!next.empty()) {
+                exec_cmds(next);
+                if (has_quit())
                     break;
             }
         }
     }
+    stop_all();
+    ringer.join();
+    tenants.clear();
+    status.reset();
+    notifications.reset();
+    events.reset();
 }
@@ -0,0 +1,189 @@
+#include <cstring>
+#include <stdexcept>
+#include "messages.h"
+
+namespace spclock {
+
+namespace {
+constexpr size_t chunk_size = 64 * 1024;
+
+// FNV-1a
+uint64_t hash(const char* data, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i != size; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+}
+
+constexpr message_pool::handle message_pool::empty;
+
+message_pool::message_pool()
+      :next_{nullptr}, left_{0}, slots_(64, 0), stored_{0}, bytes_{0}, dead_{0} {
+    texts_.push_back({"", 0});
+    refs_.push_back(0);
+};
+
+// bump allocation, texts bigger than a chunk get a chunk of their own
+char* message_pool::allocate(size_t size) {
+    if (size > left_) {
+        auto n = (size > chunk_size) ? size : chunk_size;
+        chunks_.emplace_back(new char[n]);
+        next_ = chunks_.back().get();
+        left_ = n;
+    }
+    auto ret = next_;
+    next_ += size;
+    left_ -= size;
+    return ret;
+};
+
+void message_pool::grow() {
+    std::vector<handle> slots(slots_.size() * 2, 0);
+    auto mask = slots.size() - 1;
+    for (handle h = 1; h != texts_.size(); ++h) {
+        if (texts_[h].size == 0)
+            continue;
+        auto i = hash(texts_[h].data, texts_[h].size) & mask;
+        while (slots[i])
+            i = (i + 1) & mask;
+        slots[i] = h + 1;
+    }
+    slots_.swap(slots);
+};
+
+size_t message_pool::find_slot(handle h) const {
+    auto mask = slots_.size() - 1;
+    auto i = hash(texts_[h].data, texts_[h].size) & mask;
+    while (slots_[i] != h + 1)
+        i = (i + 1) & mask;
+    return i;
+};
+
+// shifts the entries after the slot back into the gap where they may go,
+// so no probe sequence is cut short
+void message_pool::erase_slot(size_t i) {
+    auto mask = slots_.size() - 1;
+    for (auto j = (i + 1) & mask; slots_[j]; j = (j + 1) & mask) {
+        auto& t = texts_[slots_[j] - 1];
+        auto home = hash(t.data, t.size) & mask;
+        // the entry may move back unless its home lies in (i, j]
+        bool stays = (i < j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i] = 0;
+};
+
+// live texts are copied into new chunks, the old ones go
+void message_pool::compact() {
+    std::vector<std::unique_ptr<char[]>> old;
+    old.swap(chunks_);
+    next_ = nullptr;
+    left_ = 0;
+    for (handle h = 1; h != texts_.size(); ++h) {
+        auto& t = texts_[h];
+        if (t.size == 0)
+            continue;
+        auto p = allocate(t.size);
+        std::memcpy(p, t.data, t.size);
+        t.data = p;
+    }
+    dead_ = 0;
+};
+
+message_pool::handle message_pool::intern(const char* data, size_t size) {
+    if (size == 0)
+        return empty;
+    if (size > UINT32_MAX)
+        throw std::length_error("Message too long");
+
+    auto mask = slots_.size() - 1;
+    auto i = hash(data, size) & mask;
+    for (; slots_[i]; i = (i + 1) & mask) {
+        auto& t = texts_[slots_[i] - 1];
+        if (t.size == size && std::memcmp(t.data, data, size) == 0)
+            return slots_[i] - 1;
+    }
+
+    // holes filled since they were freed are skipped
+    while (!free_.empty() && texts_[free_.back()].size != 0)
+        free_.pop_back();
+    if (free_.empty() && texts_.size() >= UINT32_MAX)
+        throw std::length_error("Too many distinct messages");
+    auto p = allocate(size);
+    std::memcpy(p, data, size);
+    handle h;
+    if (free_.empty()) {
+        h = static_cast<handle>(texts_.size());
+        texts_.push_back({p, static_cast<uint32_t>(size)});
+        refs_.push_back(0);
+    } else {
+        h = free_.back();
+        free_.pop_back();
+        texts_[h] = {p, static_cast<uint32_t>(size)};
+    }
+    bytes_ += size;
+    slots_[i] = h + 1;
+    // load factor stays under a half
+    if (++stored_ * 2 > slots_.size())
+        grow();
+    return h;
+};
+
+uint32_t message_pool::acquire(handle h) {
+    return h == empty ? 0 : ++refs_[h];
+};
+
+void message_pool::release(handle h) {
+    if (h == empty || refs_[h] == 0 || --refs_[h] != 0)
+        return;
+    erase_slot(find_slot(h));
+    --stored_;
+    bytes_ -= texts_[h].size;
+    dead_ += texts_[h].size;
+    texts_[h] = {"", 0};
+    free_.push_back(h);
+    if (dead_ > bytes_ && dead_ >= chunk_size)
+        compact();
+};
+
+void message_pool::extend(size_t n) {
+    if (n > UINT32_MAX)
+        throw std::length_error("Too many distinct messages");
+    for (auto h = texts_.size(); h < n; ++h)
+        free_.push_back(static_cast<handle>(h));
+    if (n > texts_.size()) {
+        texts_.resize(n, {"", 0});
+        refs_.resize(n, 0);
+    }
+};
+
+void message_pool::place(handle h, const char* data, size_t size) {
+    if (h == empty || h >= texts_.size() || texts_[h].size != 0 || size == 0)
+        throw std::logic_error("No hole for the message");
+    if (size > UINT32_MAX)
+        throw std::length_error("Message too long");
+
+    auto mask = slots_.size() - 1;
+    auto i = hash(data, size) & mask;
+    for (; slots_[i]; i = (i + 1) & mask) {
+        auto& t = texts_[slots_[i] - 1];
+        if (t.size == size && std::memcmp(t.data, data, size) == 0)
+            throw std::logic_error("The message is there already");
+    }
+    auto p = allocate(size);
+    std::memcpy(p, data, size);
+    texts_[h] = {p, static_cast<uint32_t>(size)};
+    bytes_ += size;
+    slots_[i] = h + 1;
+    // load factor stays under a half
+    if (++stored_ * 2 > slots_.size())
+        grow();
+};
+
+} // namespace spclock
@@ -0,0 +1,72 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace spclock {
+
+// a message text inside the pool's arena. good until the pool changes
+struct msg_ref {
+    const char* data;
+    uint32_t size;
+
+    std::string str() const { return std::string(data, size); }
+};
+
+// interned message texts. every distinct text is stored once in an arena
+// and buzzers hold a 32 bit handle to it, reminder sets reuse a few texts.
+// a text goes once the last buzzer holding it releases it, its handle is
+// handed out again and the arena is compacted once more of it is dead
+// than alive
+class message_pool {
+public:
+    using handle = uint32_t;
+    static constexpr handle empty = 0;
+
+    message_pool();
+    message_pool(const message_pool&) = delete;
+    message_pool& operator=(const message_pool&) = delete;
+
+    // a new text is held by nobody yet
+    handle intern(const char*, size_t);
+    handle intern(const std::string& s) { return intern(s.data(), s.size()); }
+    msg_ref get(handle h) const { return texts_[h]; }
+    // returns the holders after this one, the empty text has none
+    uint32_t acquire(handle);
+    void release(handle);
+    // makes the handles below n valid, the new ones as holes reading empty
+    void extend(size_t n);
+    // puts the text into a hole, so it gets back the handle it had
+    void place(handle, const char*, size_t);
+
+    // handles handed out, holes included
+    size_t count() const { return texts_.size(); }
+    size_t bytes() const { return bytes_; }
+    // of the arena, dead texts included
+    size_t arena_bytes() const { return bytes_ + dead_; }
+
+private:
+    char* allocate(size_t);
+    void grow();
+    size_t find_slot(handle) const;
+    void erase_slot(size_t);
+    void compact();
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* next_;          // free space in the last chunk
+    size_t left_;
+    std::vector<msg_ref> texts_;
+    std::vector<uint32_t> refs_;   // by handle
+    std::vector<handle> free_;     // holes to hand out again
+    std::vector<handle> slots_;    // open addressing, handle + 1 or 0
+    size_t stored_;                // texts in the slots
+    size_t bytes_;
+    size_t dead_;                  // of released texts still in the arena
+};
+
+} // namespace spclock
+
+#endif
@@ -0,0 +1,276 @@
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "notify.h"
+#include "command.h"
+
+extern char** environ;
+
+namespace spclock {
+
+namespace {
+[[noreturn]] void fail(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// false if the reader went away or the descriptor is broken
+bool write_full(int fd, const char* p, size_t n) {
+    while (n) {
+        auto put = ::write(fd, p, n);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put < 0)
+            return false;
+        p += put;
+        n -= put;
+    }
+    return true;
+}
+
+// <id> <namespace> <deadline> <tag or -> <message>, the message last so
+// a shell's read takes all of it
+std::string line_of(const notification& n) {
+    std::string line;
+    line.reserve(n.space.size() + n.tag.size() + n.message.size() + 48);
+    line += std::to_string(n.id);
+    line += ' ';
+    line += n.space;
+    line += ' ';
+    line += std::to_string(n.deadline);
+    line += ' ';
+    line += n.tag.empty() ? std::string{"-"} : n.tag;
+    line += ' ';
+    line += n.message;
+    line += '\n';
+    return line;
+}
+
+// waits for its line, exports it and becomes the command
+constexpr const char* warm_script =
+    "IFS=' ' read -r SPCLOCK_ID SPCLOCK_NAMESPACE SPCLOCK_DEADLINE "
+    "SPCLOCK_TAG SPCLOCK_MESSAGE || exit 0; "
+    "export SPCLOCK_ID SPCLOCK_NAMESPACE SPCLOCK_DEADLINE SPCLOCK_TAG "
+    "SPCLOCK_MESSAGE; exec /bin/sh -c \"$0\"";
+}
+
+void bell_sink::deliver(const notification&) {
+    write_full(STDOUT_FILENO, "\7", 1);
+};
+
+file_sink::file_sink(const std::string& path)
+      :fd_{::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)} {
+    if (fd_ < 0)
+        fail("Cannot open " + path);
+};
+
+file_sink::~file_sink() {
+    ::close(fd_);
+}
+
+void file_sink::deliver(const notification& n) {
+    auto line = line_of(n);
+    write_full(fd_, line.data(), line.size());
+};
+
+fd_sink::fd_sink(int fd) :fd_{fd}, eventfd_{false} {
+    if (::fcntl(fd, F_GETFD) < 0)
+        fail("Not an open descriptor: " + std::to_string(fd));
+    std::signal(SIGPIPE, SIG_IGN);
+    char link[64];
+    auto proc = "/proc/self/fd/" + std::to_string(fd);
+    auto len = ::readlink(proc.c_str(), link, sizeof(link));
+    eventfd_ = len > 0 && std::string(link, len) == "anon_inode:[eventfd]";
+};
+
+void fd_sink::deliver(const notification& n) {
+    if (eventfd_) {
+        uint64_t one = 1;
+        write_full(fd_, reinterpret_cast<const char*>(&one), sizeof(one));
+        return;
+    }
+    auto line = line_of(n);
+    write_full(fd_, line.data(), line.size());
+};
+
+exec_sink::exec_sink(const std::string& command, size_t warm)
+      :command_{command}, warm_{warm} {
+    std::signal(SIGPIPE, SIG_IGN);
+    try {
+        while (idle_.size() != warm_)
+            idle_.push_back(spawn());
+    } catch (...) {
+        for (auto& s:idle_)
+            ::close(s.fd);
+        throw;
+    }
+};
+
+// the warm ones read the end of their input and exit. the ones running
+// commands are left alone, they outlive the clock
+exec_sink::~exec_sink() {
+    for (auto& s:idle_) {
+        ::close(s.fd);
+        ::waitpid(s.pid, nullptr, 0);
+    }
+    reap();
+}
+
+void exec_sink::deliver(const notification& n) {
+    reap();
+    if (idle_.empty())
+        idle_.push_back(spawn());
+    auto s = idle_.back();
+    idle_.pop_back();
+    auto line = line_of(n);
+    write_full(s.fd, line.data(), line.size());
+    ::close(s.fd);
+    busy_.push_back(s.pid);
+    // for the next one, after this one is on its way
+    try {
+        while (idle_.size() < warm_)
+            idle_.push_back(spawn());
+    } catch (std::exception&) {
+    }
+};
+
+exec_sink::shell exec_sink::spawn() {
+    int p[2];
+    if (::pipe2(p, O_CLOEXEC) < 0)
+        fail("Cannot create pipe");
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, p[0], STDIN_FILENO);
+    const char* argv[] = {"/bin/sh", "-c", warm_script, command_.c_str(), nullptr};
+    pid_t pid;
+    auto r = posix_spawn(&pid, "/bin/sh", &actions, nullptr,
+                         const_cast<char* const*>(argv), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(p[0]);
+    if (r != 0) {
+        ::close(p[1]);
+        errno = r;
+        fail("Cannot spawn /bin/sh");
+    }
+    return {pid, p[1]};
+};
+
+// only ever waits for its own children, others may have theirs
+void exec_sink::reap() {
+    for (size_t i = 0; i != busy_.size(); ) {
+        if (::waitpid(busy_[i], nullptr, WNOHANG) != 0) {
+            busy_[i] = busy_.back();
+            busy_.pop_back();
+        } else {
+            ++i;
+        }
+    }
+};
+
+constexpr size_t notifier::queue_capacity;
+
+notifier::~notifier() {
+    for (auto& w:workers_) {
+        {
+            std::lock_guard<std::mutex> lck(w->m);
+            w->quit = true;
+        }
+        w->cv.notify_one();
+    }
+    for (auto& w:workers_)
+        w->thread.join();
+}
+
+void notifier::add(std::unique_ptr<sink> s) {
+    std::unique_ptr<worker> w{new worker};
+    w->out = std::move(s);
+    auto raw = w.get();
+    w->thread = std::thread{[raw] { run(*raw); }};
+    workers_.push_back(std::move(w));
+};
+
+void notifier::notify(const std::string& space, const sched_event& ev) {
+    if (ev.kind != event_kind::fire)
+        return;
+    notification n{false, space, ev.id, ev.deadline,
+                   std::string(ev.tag.data, ev.tag.size),
+                   std::string(ev.message.data, ev.message.size)};
+    for (auto& w:workers_) {
+        if (!w->out->reminders())
+            push(*w, n);
+    }
+};
+
+void notifier::remind() {
+    notification n{true, std::string{}, 0, 0, std::string{}, std::string{}};
+    for (auto& w:workers_) {
+        if (!w->out->reminders())
+            continue;
+        std::unique_lock<std::mutex> lck(w->m);
+        if (!w->queue.empty())
+            continue;
+        w->queue.push_back(n);
+        lck.unlock();
+        w->cv.notify_one();
+    }
+};
+
+size_t notifier::dropped() {
+    size_t ret = 0;
+    for (auto& w:workers_) {
+        std::lock_guard<std::mutex> lck(w->m);
+        ret += w->dropped;
+    }
+    return ret;
+};
+
+void notifier::push(worker& w, const notification& n) {
+    {
+        std::lock_guard<std::mutex> lck(w.m);
+        if (w.queue.size() == queue_capacity) {
+            ++w.dropped;
+            return;
+        }
+        w.queue.push_back(n);
+    }
+    w.cv.notify_one();
+};
+
+// a sink that throws loses that one notification, nothing else
+void notifier::run(worker& w) {
+    std::unique_lock<std::mutex> lck(w.m);
+    for (;;) {
+        w.cv.wait(lck, [&] { return w.quit || !w.queue.empty(); });
+        if (w.queue.empty())
+            return;
+        auto n = std::move(w.queue.front());
+        w.queue.pop_front();
+        lck.unlock();
+        try {
+            w.out->deliver(n);
+        } catch (std::exception&) {
+        }
+        lck.lock();
+    }
+};
+
+std::unique_ptr<sink> make_sink(const std::string& spec) {
+    auto colon = spec.find(':');
+    auto kind = spec.substr(0, colon);
+    auto arg = (colon == std::string::npos) ? std::string{} : spec.substr(colon + 1);
+    if (kind == "bell" && colon == std::string::npos)
+        return std::unique_ptr<sink>{new bell_sink};
+    if (kind == "file" && !arg.empty())
+        return std::unique_ptr<sink>{new file_sink(arg)};
+    if (kind == "fd" && !arg.empty())
+        return std::unique_ptr<sink>{new fd_sink(static_cast<int>(parse_number(arg)))};
+    if (kind == "exec" && !arg.empty())
+        return std::unique_ptr<sink>{new exec_sink(arg)};
+    throw std::invalid_argument("Unknown notification sink: " + spec);
+};
+
+} // namespace spclock
@@ -0,0 +1,138 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "events.h"
+
+namespace spclock {
+
+// a buzzer that went off, or a reminder that something still rings
+struct notification {
+    bool reminder;
+    std::string space;      // the namespace
+    size_t id;
+    int64_t deadline;       // seconds since epoch
+    std::string tag;
+    std::string message;
+};
+
+// somewhere notifications go. a sink gets either the reminders or every
+// buzzer going off, one at a time on a thread of its own, so it may take
+// as long as it likes
+class sink {
+public:
+    virtual ~sink() = default;
+    virtual void deliver(const notification&) = 0;
+    virtual bool reminders() const { return false; }
+};
+
+// rings the terminal bell for every reminder
+class bell_sink : public sink {
+public:
+    void deliver(const notification&) override;
+    bool reminders() const override { return true; }
+};
+
+// appends a line per buzzer to a file, in a single write each
+class file_sink : public sink {
+public:
+    explicit file_sink(const std::string& path);
+    ~file_sink();
+    void deliver(const notification&) override;
+
+private:
+    int fd_;
+};
+
+// signals a descriptor the clock was started with. an eventfd is counted
+// up by one per buzzer, anything else like a pipe gets a line
+class fd_sink : public sink {
+public:
+    explicit fd_sink(int fd);
+    void deliver(const notification&) override;
+
+private:
+    int fd_;
+    bool eventfd_;
+};
+
+// runs a shell command per buzzer, with SPCLOCK_ID, SPCLOCK_NAMESPACE,
+// SPCLOCK_DEADLINE, SPCLOCK_TAG and SPCLOCK_MESSAGE set. shells are
+// spawned ahead of time and wait for the line with the values, so a
+// buzzer going off costs a write instead of a fork
+class exec_sink : public sink {
+public:
+    explicit exec_sink(const std::string& command, size_t warm = 2);
+    ~exec_sink();
+    void deliver(const notification&) override;
+
+private:
+    struct shell {
+        pid_t pid;
+        int fd;     // its stdin
+    };
+
+    shell spawn();
+    void reap();
+
+    std::string command_;
+    size_t warm_;
+    std::vector<shell> idle_;
+    std::vector<pid_t> busy_;
+};
+
+// fans notifications out to the sinks. every sink has a queue and a
+// thread of its own, notify() only copies into the queues and never
+// waits for a sink, a slow one just falls behind. a full queue drops
+// the newest notifications
+class notifier {
+public:
+    static constexpr size_t queue_capacity = 1024;
+
+    notifier() = default;
+    // delivers what is queued before returning
+    ~notifier();
+    notifier(const notifier&) = delete;
+    notifier& operator=(const notifier&) = delete;
+
+    void add(std::unique_ptr<sink>);
+    bool empty() const { return workers_.empty(); }
+    // the sinks that want buzzers get a fire event
+    void notify(const std::string& space, const sched_event&);
+    // the sinks that want reminders get one, unless they have one queued
+    void remind();
+    // notifications lost to full queues
+    size_t dropped();
+
+private:
+    struct worker {
+        std::unique_ptr<sink> out;
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<notification> queue;
+        bool quit = false;
+        size_t dropped = 0;
+        std::thread thread;
+    };
+
+    static void run(worker&);
+    static void push(worker&, const notification&);
+
+    std::vector<std::unique_ptr<worker>> workers_;
+};
+
+// a sink from one entry of --notify: bell, file:<path>, fd:<n> or
+// exec:<command>. throws on anything else or if it cannot be set up
+std::unique_ptr<sink> make_sink(const std::string&);
+
+} // namespace spclock
+
+#endif
@@ -2,7 +2,9 @@
 #define PARSE_H
 
 #include <chrono>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <cmath>
 
@@ -11,10 +13,10 @@ namespace spclock {
 using seconds = std::chrono::seconds;
 using string = std::string;
 
-inline bool strTime_valid(const string& str) {
+inline bool strTime_valid(std::string_view str) {
     // checking the string passed in has only numbers and ':'
 
-    if (str.length() > 15) {
+    if (str.empty() || str.length() > 15) {
         // arbitrary limit
         return false;
     }
@@ -32,7 +34,10 @@ inline bool strTime_valid(const string& str) {
     return (itr == str.end());
 };
 
-inline seconds parse_time(const string& str) {
+// the most parse_time reads, fifteen digits without colons
+constexpr int64_t max_time = 999999999999999;
+
+inline seconds parse_time(std::string_view str) {
     if (!strTime_valid(str)) {
         throw std::runtime_error("Time format not valid");
     }
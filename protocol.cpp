@@ -0,0 +1,154 @@
+#include <cstring>
+#include <stdexcept>
+#include "protocol.h"
+
+namespace spclock {
+
+namespace {
+constexpr size_t head = sizeof(uint32_t);
+// request ID and the op or status byte
+constexpr size_t fixed = sizeof(uint32_t) + 1;
+
+template <typename T>
+void put(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+T get(const char*& p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return v;
+}
+
+[[noreturn]] void malformed() {
+    throw std::runtime_error("Malformed frame");
+}
+
+// reserves room for the size and returns where it goes
+size_t begin(std::string& out, uint32_t id, uint8_t op) {
+    auto at = out.size();
+    put(out, uint32_t{0});
+    put(out, id);
+    put(out, op);
+    return at;
+}
+
+void end(std::string& out, size_t at) {
+    uint32_t size = out.size() - at - head;
+    std::memcpy(&out[at], &size, sizeof(size));
+}
+}
+
+size_t frame_size(const char* data, size_t size) {
+    if (size < head)
+        return 0;
+    uint32_t n;
+    std::memcpy(&n, data, sizeof(n));
+    if (n < fixed || n > max_frame)
+        malformed();
+    return head + n;
+};
+
+void encode(const request& r, std::string& out) {
+    auto at = begin(out, r.id, static_cast<uint8_t>(r.op));
+    switch (r.op) {
+    case wire_op::add:
+        put(out, r.seconds);
+        put(out, r.type);
+        put(out, r.priority);
+        put(out, r.sync);
+        if (r.tag.size() > UINT8_MAX)
+            throw std::length_error("Tag too long");
+        put(out, static_cast<uint8_t>(r.tag.size()));
+        out.append(r.tag);
+        out.append(r.message);
+        break;
+    case wire_op::stop:
+        put(out, r.buzzer);
+        break;
+    case wire_op::snooze:
+        put(out, r.buzzer);
+        put(out, r.seconds);
+        break;
+    case wire_op::use:
+        out.append(r.tag);
+        break;
+    }
+    end(out, at);
+};
+
+void encode(const reply& r, std::string& out) {
+    auto at = begin(out, r.id, r.ok ? 0 : 1);
+    if (r.ok)
+        put(out, r.value);
+    else
+        out.append(r.error);
+    end(out, at);
+};
+
+size_t decode(const char* data, size_t size, request& r) {
+    auto n = frame_size(data, size);
+    if (n == 0 || n > size)
+        return 0;
+    auto p = data + head;
+    auto end = data + n;
+    r.id = get<uint32_t>(p);
+    r.op = static_cast<wire_op>(get<uint8_t>(p));
+    auto left = static_cast<size_t>(end - p);
+    switch (r.op) {
+    case wire_op::add:
+        if (left < sizeof(int64_t) + 4)
+            malformed();
+        r.seconds = get<int64_t>(p);
+        r.type = get<uint8_t>(p);
+        r.priority = get<uint8_t>(p);
+        r.sync = get<uint8_t>(p);
+        left = get<uint8_t>(p);
+        if (static_cast<size_t>(end - p) < left)
+            malformed();
+        r.tag.assign(p, left);
+        r.message.assign(p + left, end);
+        break;
+    case wire_op::stop:
+        if (left != sizeof(uint64_t))
+            malformed();
+        r.buzzer = get<uint64_t>(p);
+        break;
+    case wire_op::snooze:
+        if (left != sizeof(uint64_t) + sizeof(int64_t))
+            malformed();
+        r.buzzer = get<uint64_t>(p);
+        r.seconds = get<int64_t>(p);
+        break;
+    case wire_op::use:
+        r.tag.assign(p, end);
+        break;
+    default:
+        malformed();
+    }
+    return n;
+};
+
+size_t decode(const char* data, size_t size, reply& r) {
+    auto n = frame_size(data, size);
+    if (n == 0 || n > size)
+        return 0;
+    auto p = data + head;
+    auto end = data + n;
+    r.id = get<uint32_t>(p);
+    r.ok = get<uint8_t>(p) == 0;
+    r.value = 0;
+    r.error.clear();
+    if (r.ok) {
+        if (end - p != sizeof(uint64_t))
+            malformed();
+        r.value = get<uint64_t>(p);
+    } else {
+        r.error.assign(p, end);
+    }
+    return n;
+};
+
+} // namespace spclock
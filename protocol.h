@@ -0,0 +1,57 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <string>
+
+namespace spclock {
+
+// binary daemon protocol. a client opens with the magic, after that both
+// sides send frames: a 32 bit size of what follows, a 32 bit request ID
+// picked by the client and an op or status byte, then the payload.
+// integers are in host byte order, the socket never leaves the machine.
+// requests are answered in order, so clients may pipeline them. the last
+// byte of the magic is the version, 2 added tags and namespaces
+constexpr char wire_magic[4] = {'S', 'P', 'C', '2'};
+constexpr size_t max_frame = 64 * 1024;
+
+enum class wire_op : uint8_t {
+    add = 1,   // seconds, type, priority, durability, tag size, the tag, then the message
+    stop,      // buzzer ID
+    snooze,    // buzzer ID, seconds
+    use        // namespace name, the requests after it go there
+};
+
+struct request {
+    uint32_t id;
+    wire_op op;
+    uint64_t buzzer = 0;
+    int64_t seconds = 0;  // from now, or the time of day for an alarm
+    uint8_t type = 0;     // b_type
+    uint8_t priority = 0; // b_priority
+    uint8_t sync = 0;     // durability
+    std::string tag;      // of an add, or the namespace of a use
+    std::string message;
+};
+
+// an add answers with the buzzer ID, stop and snooze with the old state,
+// use with zero
+struct reply {
+    uint32_t id;
+    bool ok;
+    uint64_t value;
+    std::string error;
+};
+
+void encode(const request&, std::string&);
+void encode(const reply&, std::string&);
+// both return the bytes taken, zero if the frame is not complete yet.
+// they throw std::runtime_error on malformed frames
+size_t decode(const char*, size_t, request&);
+size_t decode(const char*, size_t, reply&);
+// size of the frame at the front, zero if its size is not complete yet
+size_t frame_size(const char*, size_t);
+
+} // namespace spclock
+
+#endif
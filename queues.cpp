@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <stdexcept>
+#include "queues.h"
+
+namespace spclock {
+
+queue_kind parse_queue_kind(const std::string& str) {
+    if (str == "heap")
+        return queue_kind::heap;
+    if (str == "calendar")
+        return queue_kind::calendar;
+    if (str == "radix")
+        return queue_kind::radix;
+    throw std::invalid_argument("Unknown scheduler: " + str);
+};
+
+std::unique_ptr<deadline_queue> make_queue(queue_kind kind) {
+    switch (kind) {
+    case queue_kind::calendar:
+        return std::unique_ptr<deadline_queue>(new calendar_queue);
+    case queue_kind::radix:
+        return std::unique_ptr<deadline_queue>(new radix_heap);
+    default:
+        return std::unique_ptr<deadline_queue>(new binary_heap);
+    }
+};
+
+namespace {
+constexpr size_t min_buckets = 2;
+
+int64_t floor_div(int64_t a, int64_t b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+bool later(const deadline_entry& a, const deadline_entry& b) {
+    return a.deadline > b.deadline;
+}
+}
+
+calendar_queue::calendar_queue()
+      :buckets_(min_buckets), width_{1}, cur_{0}, cur_top_{0}, size_{0},
+       located_{false} { }
+
+size_t calendar_queue::bucket_of(int64_t t) const {
+    auto day = floor_div(t, width_) % static_cast<int64_t>(buckets_.size());
+    return static_cast<size_t>(day < 0 ? day + buckets_.size() : day);
+};
+
+void calendar_queue::move_to(int64_t t) {
+    cur_ = bucket_of(t);
+    cur_top_ = (floor_div(t, width_) + 1) * width_;
+    located_ = false;
+};
+
+void calendar_queue::push(deadline_entry e) {
+    // nothing may sit before the bucket the search starts from
+    if (size_ == 0 || e.deadline < cur_top_ - width_)
+        move_to(e.deadline);
+    auto& b = buckets_[bucket_of(e.deadline)];
+    // in front of equal deadlines, so those go off in insertion order
+    b.insert(std::lower_bound(b.begin(), b.end(), e, later), e);
+    ++size_;
+    located_ = false;
+    if (size_ > 2 * buckets_.size())
+        resize(2 * buckets_.size());
+};
+
+// walks the year from the current bucket, falling back to a direct
+// search when nothing is due within a year
+void calendar_queue::locate() {
+    if (located_)
+        return;
+    auto i = cur_;
+    auto top = cur_top_;
+    for (size_t n = 0; n != buckets_.size(); ++n) {
+        auto& b = buckets_[i];
+        if (!b.empty() && b.back().deadline < top) {
+            cur_ = i;
+            cur_top_ = top;
+            located_ = true;
+            return;
+        }
+        if (++i == buckets_.size())
+            i = 0;
+        top += width_;
+    }
+
+    const deadline_entry* min = nullptr;
+    for (auto& b:buckets_) {
+        if (!b.empty() && (!min || b.back().deadline < min->deadline))
+            min = &b.back();
+    }
+    move_to(min->deadline);
+    located_ = true;
+};
+
+deadline_entry calendar_queue::top() {
+    locate();
+    return buckets_[cur_].back();
+};
+
+void calendar_queue::pop() {
+    locate();
+    buckets_[cur_].pop_back();
+    --size_;
+    located_ = false;
+    if (buckets_.size() > min_buckets && size_ < buckets_.size() / 2)
+        resize(buckets_.size() / 2);
+};
+
+// a day is three times the average gap between the earliest deadlines
+void calendar_queue::resize(size_t n) {
+    std::vector<deadline_entry> all;
+    all.reserve(size_);
+    for (auto& b:buckets_)
+        all.insert(all.end(), b.begin(), b.end());
+    // stable, so equal deadlines keep their order within the buckets
+    std::stable_sort(all.begin(), all.end(), later);
+
+    width_ = 1;
+    auto k = std::min<size_t>(all.size(), 25);
+    if (k > 1) {
+        auto span = all[all.size() - 1 - (k - 1)].deadline - all.back().deadline;
+        width_ = std::max<int64_t>(1, 3 * span / static_cast<int64_t>(k - 1));
+    }
+
+    buckets_.assign(n, std::vector<deadline_entry>{});
+    if (!all.empty())
+        move_to(all.back().deadline);
+    for (auto& e:all)
+        buckets_[bucket_of(e.deadline)].push_back(e);
+};
+
+radix_heap::radix_heap() : last_{0}, size_{0} { };
+
+// order preserving map of signed seconds to unsigned keys
+uint64_t radix_heap::key(int64_t t) {
+    return static_cast<uint64_t>(t) ^ (uint64_t{1} << 63);
+};
+
+size_t radix_heap::bucket_of(uint64_t k) const {
+    return (k == last_) ? 0 : 64 - __builtin_clzll(k ^ last_);
+};
+
+void radix_heap::push(deadline_entry e) {
+    auto k = key(e.deadline);
+    if (size() == 0)
+        last_ = k;
+    if (k < last_) {
+        early_.push(e);
+        return;
+    }
+    buckets_[bucket_of(k)].push_back(e);
+    ++size_;
+};
+
+// the minimum of the first non-empty bucket becomes the new last minimum,
+// every entry of that bucket then falls into a lower one
+void radix_heap::redistribute() {
+    size_t i = 1;
+    while (buckets_[i].empty())
+        ++i;
+    std::vector<deadline_entry> moving;
+    moving.swap(buckets_[i]);
+    last_ = key(std::min_element(moving.begin(), moving.end(),
+                [](const deadline_entry& a, const deadline_entry& b) {
+                    return a.deadline < b.deadline; })->deadline);
+    for (auto& e:moving)
+        buckets_[bucket_of(key(e.deadline))].push_back(e);
+};
+
+deadline_entry radix_heap::top() {
+    if (!early_.empty())
+        return early_.top();
+    if (buckets_[0].empty())
+        redistribute();
+    return buckets_[0].back();
+};
+
+void radix_heap::pop() {
+    if (!early_.empty()) {
+        early_.pop();
+        return;
+    }
+    if (buckets_[0].empty())
+        redistribute();
+    buckets_[0].pop_back();
+    --size_;
+};
+
+} // namespace spclock
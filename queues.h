@@ -0,0 +1,103 @@
+#ifndef QUEUES_H
+#define QUEUES_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <array>
+#include <queue>
+
+namespace spclock {
+
+struct deadline_entry {
+    int64_t deadline;  // seconds since epoch
+    size_t id;
+    bool operator>(const deadline_entry& o) const { return deadline > o.deadline; }
+};
+
+// the deadline structure behind the scheduler
+class deadline_queue {
+public:
+    virtual ~deadline_queue() = default;
+    virtual void push(deadline_entry) = 0;
+    virtual bool empty() const = 0;
+    virtual size_t size() const = 0;
+    // not const, structures may reorganize lazily on access
+    virtual deadline_entry top() = 0;
+    virtual void pop() = 0;
+};
+
+enum class queue_kind {
+    heap,
+    calendar,
+    radix
+};
+
+queue_kind parse_queue_kind(const std::string&);
+std::unique_ptr<deadline_queue> make_queue(queue_kind);
+
+class binary_heap : public deadline_queue {
+    std::priority_queue<deadline_entry, std::vector<deadline_entry>,
+                        std::greater<deadline_entry>> heap_;
+
+public:
+    void push(deadline_entry e) override { heap_.push(e); }
+    bool empty() const override { return heap_.empty(); }
+    size_t size() const override { return heap_.size(); }
+    deadline_entry top() override { return heap_.top(); }
+    void pop() override { heap_.pop(); }
+};
+
+// Brown's calendar queue: buckets of one "day" each, wrapping around a
+// "year". O(1) on average when the bucket width matches the spacing of
+// deadlines, which is kept up by resizing with the queue size
+class calendar_queue : public deadline_queue {
+    // each bucket is sorted descending, its earliest entry at the back
+    std::vector<std::vector<deadline_entry>> buckets_;
+    int64_t width_;
+    size_t cur_;        // bucket the earliest entry is in or after
+    int64_t cur_top_;   // end of cur_ in the current year
+    size_t size_;
+    bool located_;      // cur_ holds the earliest entry
+
+    size_t bucket_of(int64_t) const;
+    void move_to(int64_t);
+    void locate();
+    void resize(size_t);
+
+public:
+    calendar_queue();
+    void push(deadline_entry) override;
+    bool empty() const override { return size_ == 0; }
+    size_t size() const override { return size_; }
+    deadline_entry top() override;
+    void pop() override;
+};
+
+// monotone radix heap. keys are bucketed by the highest bit they differ
+// from the last minimum in, so each entry moves down at most 64 times.
+// a deadline behind the last minimum can only be a new buzzer due before
+// everything queued, those few go to a side heap
+class radix_heap : public deadline_queue {
+    std::array<std::vector<deadline_entry>, 65> buckets_;
+    binary_heap early_;
+    uint64_t last_;
+    size_t size_;
+
+    static uint64_t key(int64_t);
+    size_t bucket_of(uint64_t) const;
+    void redistribute();
+
+public:
+    radix_heap();
+    void push(deadline_entry) override;
+    bool empty() const override { return size() == 0; }
+    size_t size() const override { return size_ + early_.size(); }
+    deadline_entry top() override;
+    void pop() override;
+};
+
+} // namespace spclock
+
+#endif
@@ -0,0 +1,227 @@
+#include <charconv>
+#include "render.h"
+
+namespace spclock {
+
+namespace {
+void pad(std::string& out, size_t len, size_t width) {
+    if (len < width)
+        out.append(width - len, ' ');
+}
+
+char* put_two(char* p, int64_t n) {
+    *p++ = static_cast<char>('0' + n / 10);
+    *p++ = static_cast<char>('0' + n % 10);
+    return p;
+}
+}
+
+constexpr int list_renderer::id_width;
+constexpr int list_renderer::time_width;
+constexpr int list_renderer::to_finish_width;
+constexpr int list_renderer::message_width;
+constexpr size_t list_renderer::line_size;
+constexpr size_t list_renderer::time_left_column;
+
+list_renderer::list_renderer(date::sys_seconds now)
+      :now_{now}, zone_{nullptr}, info_{} { }
+
+void list_renderer::edge(std::string& out) const {
+    out += '+';
+    out.append(id_width + 1, '-');
+    out += '+';
+    out.append(time_width + 1, '-');
+    out += '+';
+    out.append(to_finish_width + 1, '-');
+    out += '+';
+    out.append(message_width + 1, '-');
+    out += "+\n";
+}
+
+void list_renderer::header(std::string& out) const {
+    auto cell = [&](const char* title, size_t width) {
+        std::string_view t{title};
+        pad(out, t.size(), width);
+        out += t;
+        out += " |";
+    };
+    out += '|';
+    cell("ID", id_width);
+    cell("Finish Time", time_width);
+    cell("Time to finish", to_finish_width);
+    cell("Message", message_width);
+    out += '\n';
+}
+
+void list_renderer::row(std::string& out, const buzzer_view& b) {
+    row_start(out, b);
+    time_left(out, b.deadline);
+    row_end(out, b.message);
+}
+
+void list_renderer::row_start(std::string& out, const buzzer_view& b) {
+    char buf[32];
+    out += '|';
+    auto r = std::to_chars(buf, buf + sizeof(buf), b.id);
+    pad(out, r.ptr - buf, id_width);
+    out.append(buf, r.ptr);
+    out += " |";
+
+    // local time of day as HH:MM:SS
+    auto secs = local(b.meta.zone, b.deadline).time_since_epoch().count() % 86400;
+    if (secs < 0)
+        secs += 86400;
+    auto p = put_two(buf, secs / 3600);
+    *p++ = ':';
+    p = put_two(p, secs / 60 % 60);
+    *p++ = ':';
+    p = put_two(p, secs % 60);
+    pad(out, p - buf, time_width);
+    out.append(buf, p);
+    out += " |";
+}
+
+void list_renderer::time_left(std::string& out, date::sys_seconds deadline) const {
+    char buf[max_duration_chars];
+    auto end = format_duration(buf, deadline - now_);
+    pad(out, end - buf, to_finish_width);
+    out.append(buf, end);
+}
+
+void list_renderer::row_end(std::string& out, msg_ref message) const {
+    out += " |";
+    if (message.size > message_width) {
+        out.append(message.data, message_width - 3);
+        out += "...";
+    } else {
+        pad(out, message.size, message_width);
+        out.append(message.data, message.size);
+    }
+    out += " |\n";
+}
+
+// offsets only change at the ends of the span the last lookup returned
+date::sys_seconds list_renderer::local(const date::time_zone* zone,
+                                       date::sys_seconds tp) {
+    if (zone != zone_ || tp < info_.begin || tp >= info_.end) {
+        info_ = zone->get_info(tp);
+        zone_ = zone;
+    }
+    return tp + info_.offset;
+}
+
+// the table starts at the top left, rows on the fourth line
+namespace {
+constexpr size_t first_row = 3;
+}
+
+list_watch::list_watch()
+      :render_{date::sys_seconds{}}, max_rows_{0}, drawn_{false}, more_{0},
+       shown_more_{0} { }
+
+void list_watch::begin(date::sys_seconds now, size_t max_rows) {
+    render_.set_now(now);
+    if (max_rows != max_rows_) {
+        max_rows_ = max_rows;
+        drawn_ = false;
+    }
+    more_ = 0;
+    next_.clear();
+    index_.clear();
+}
+
+// a row is taken over from the last frame while its deadline is the
+// same, a snoozed buzzer is rendered again
+void list_watch::row(const buzzer_view& b) {
+    auto i = next_.size();
+    if (i == max_rows_) {
+        ++more_;
+        return;
+    }
+    auto j = i;
+    if (i >= rows_.size() || rows_[i].id != b.id) {
+        if (index_.empty()) {
+            for (size_t k = 0; k != rows_.size(); ++k)
+                index_.emplace(rows_[k].id, k);
+        }
+        auto itr = index_.find(b.id);
+        j = (itr == index_.end()) ? rows_.size() : itr->second;
+    }
+    if (j < rows_.size() && rows_[j].deadline == b.deadline) {
+        next_.push_back(std::move(rows_[j]));
+        next_.back().on_line &= (j == i);
+        // moved from, it cannot be found again
+        rows_[j].deadline = date::sys_seconds::min();
+        return;
+    }
+    next_.push_back({b.id, b.deadline, std::string{}, std::string{},
+                     std::string{}, false});
+    auto& r = next_.back();
+    render_.row_start(r.start, b);
+    render_.row_end(r.end, b.message);
+}
+
+void list_watch::end(std::string& out) {
+    bool footer = !drawn_ || next_.size() != rows_.size() || more_ != shown_more_;
+    if (!drawn_) {
+        // hides the cursor and clears the screen
+        out += "\x1b[?25l\x1b[H\x1b[2J";
+        render_.edge(out);
+        render_.header(out);
+        render_.edge(out);
+    }
+    for (size_t i = 0; i != next_.size(); ++i) {
+        auto& r = next_[i];
+        left_.clear();
+        render_.time_left(left_, r.deadline);
+        if (drawn_ && r.on_line && r.left.size() == left_.size()) {
+            // the characters from the first to the last that changed
+            size_t a = 0;
+            while (a != left_.size() && left_[a] == r.left[a])
+                ++a;
+            if (a != left_.size()) {
+                auto b = left_.size() - 1;
+                while (left_[b] == r.left[b])
+                    --b;
+                move_to(out, first_row + i, list_renderer::time_left_column + a);
+                out.append(left_, a, b - a + 1);
+            }
+        } else {
+            move_to(out, first_row + i, 0);
+            out += r.start;
+            out += left_;
+            out += r.end;
+        }
+        r.left.swap(left_);
+        r.on_line = true;
+    }
+    auto bottom = first_row + next_.size();
+    if (footer) {
+        move_to(out, bottom, 0);
+        render_.edge(out);
+        if (more_)
+            out += "  and " + std::to_string(more_) + " more\n";
+        // whatever the last frame had below
+        out += "\x1b[J";
+    }
+    rows_.swap(next_);
+    shown_more_ = more_;
+    drawn_ = true;
+}
+
+void list_watch::close(std::string& out) const {
+    move_to(out, first_row + rows_.size() + (shown_more_ ? 2 : 1), 0);
+    out += "\x1b[?25h";
+}
+
+// lines and columns count from zero here, from one on the terminal
+void list_watch::move_to(std::string& out, size_t line, size_t column) {
+    char buf[24];
+    out += "\x1b[";
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), line + 1).ptr);
+    out += ';';
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), column + 1).ptr);
+    out += 'H';
+}
+
+} // namespace spclock
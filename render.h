@@ -0,0 +1,96 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "date/tz.h"
+#include "table.h"
+
+namespace spclock {
+
+// renders the list table straight into a buffer. numbers and times are
+// formatted by hand and the offset of a zone is looked up again only when
+// a deadline falls outside the span it was good for, so a row costs no
+// stream and no allocation
+class list_renderer {
+public:
+    static constexpr int id_width = 5;
+    static constexpr int time_width = 12;
+    static constexpr int to_finish_width = 34;
+    static constexpr int message_width = 40;
+    // of every line, the newline included
+    static constexpr size_t line_size = id_width + time_width +
+                                        to_finish_width + message_width + 10;
+
+    // the table shows the time to finish as of now
+    explicit list_renderer(date::sys_seconds now);
+
+    void edge(std::string&) const;
+    void header(std::string&) const;
+    void row(std::string&, const buzzer_view&);
+
+    // a row is its ID and finish time, which never change, the time to
+    // finish, and the message, which does not change either
+    void row_start(std::string&, const buzzer_view&);
+    void time_left(std::string&, date::sys_seconds deadline) const;
+    void row_end(std::string&, msg_ref message) const;
+    // of the time to finish on a line, counting from zero
+    static constexpr size_t time_left_column = id_width + time_width + 5;
+
+    void set_now(date::sys_seconds now) { now_ = now; }
+
+private:
+    date::sys_seconds local(const date::time_zone*, date::sys_seconds);
+
+    date::sys_seconds now_;
+    const date::time_zone* zone_;   // the one info is of
+    date::sys_info info_;
+};
+
+// the list table kept up to date on a terminal. every frame is diffed
+// against what is on the screen and only what changed is written, with
+// the cursor moved there first. a buzzer keeps the start and the end of
+// its row, rendered once, as long as its deadline stays the same. from
+// one second to the next it is mostly a few digits of the time to finish
+class list_watch {
+public:
+    list_watch();
+
+    // a frame is begin(), the buzzers in the order they are listed, then
+    // end(), which appends the escape sequences that draw it to out. at
+    // most max_rows are shown, and how many more there are. the table is
+    // drawn all over again when max_rows changes
+    void begin(date::sys_seconds now, size_t max_rows);
+    void row(const buzzer_view&);
+    void end(std::string& out);
+    // leaves the cursor below the table
+    void close(std::string& out) const;
+
+private:
+    struct screen_row {
+        size_t id;
+        date::sys_seconds deadline;
+        std::string start;      // ID and finish time
+        std::string left;       // the time to finish last drawn
+        std::string end;        // message
+        bool on_line;           // left is what the screen shows there
+    };
+
+    static void move_to(std::string&, size_t line, size_t column);
+
+    list_renderer render_;
+    size_t max_rows_;
+    bool drawn_;    // the screen has no table before the first frame
+    size_t more_;   // beyond max_rows
+    size_t shown_more_;
+    std::vector<screen_row> rows_;     // on the screen, line by line
+    std::vector<screen_row> next_;     // of the frame being built
+    // where an ID is in rows_, only looked at once rows moved
+    std::unordered_map<size_t, size_t> index_;
+    std::string left_;
+};
+
+} // namespace spclock
+
+#endif
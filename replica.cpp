@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "replica.h"
+#include "server.h"
+
+namespace spclock {
+
+namespace {
+constexpr char magic[8] = {'S', 'P', 'C', 'R', 'E', 'P', 'L', '2'};
+constexpr size_t read_size = 64 * 1024;
+// a follower this far behind gets dropped, it has to start over
+constexpr size_t max_backlog = 64 * 1024 * 1024;
+// counts of frames that are not a batch. a resync is the last frame a
+// follower gets before being dropped, it connects again for new snapshots
+constexpr uint32_t resync_count = UINT32_MAX;
+constexpr uint32_t snapshot_count = UINT32_MAX - 1;
+// between attempts to connect to a leader that went away
+constexpr std::chrono::milliseconds reconnect_pause{100};
+
+// the stream starts with the magic, every frame after it with this. a
+// batch is followed by count journal records of the namespace, last is
+// the leader's last record of it so the follower can tell how far behind
+// it is. a snapshot has the last record it covers there
+struct frame_header {
+    uint32_t count;
+    uint32_t space;
+    uint64_t last;
+};
+
+// after the header of a snapshot, followed by the name of the namespace
+// and size bytes of it
+struct snapshot_header {
+    uint64_t size;
+    uint32_t name_size;
+    uint32_t unused;
+};
+
+// a follower acknowledges every batch with the last record of the
+// namespace it applied
+struct ack {
+    uint32_t space;
+    uint32_t unused;
+    uint64_t seq;
+};
+
+[[noreturn]] void fail(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// blocks for all of the n bytes. false on the end of the stream, an
+// error, or nothing arriving for the timeout
+bool read_full(int fd, char* p, size_t n, std::chrono::milliseconds timeout) {
+    while (n) {
+        pollfd pfd{fd, POLLIN, 0};
+        auto r = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        auto got = ::read(fd, p, n);
+        if (got < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+bool write_full(int fd, const char* p, size_t n) {
+    while (n) {
+        auto put = ::write(fd, p, n);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put < 0)
+            return false;
+        p += put;
+        n -= put;
+    }
+    return true;
+}
+
+template <typename T>
+void append(std::string& out, const T& v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+}
+
+constexpr std::chrono::milliseconds replicator::batch_window;
+constexpr std::chrono::milliseconds replicator::heartbeat;
+
+replicator::replicator(const std::string& path)
+      :path_{path}, listen_fd_{-1}, wake_{-1, -1} {
+    std::signal(SIGPIPE, SIG_IGN);
+    listen_fd_ = listen_socket(path);
+    if (::pipe(wake_) < 0) {
+        auto err = errno;
+        ::close(listen_fd_);
+        ::unlink(path.c_str());
+        errno = err;
+        fail("Cannot create pipe");
+    }
+    sender_ = std::thread{&replicator::run, this};
+};
+
+replicator::~replicator() {
+    // a tap runs under the journal's lock and takes m_, never the other way
+    std::vector<source> sources;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        sources = sources_;
+    }
+    for (auto& src:sources)
+        src.jrnl->tap(nullptr);
+    char c = 0;
+    auto r = ::write(wake_[1], &c, 1);
+    (void)r;
+    sender_.join();
+    for (auto& f:followers_)
+        drop(f);
+    ::close(listen_fd_);
+    ::close(wake_[0]);
+    ::close(wake_[1]);
+    ::unlink(path_.c_str());
+}
+
+// the records before the tap are covered by the snapshots of the
+// namespace, none was taken before
+void replicator::add(const std::string& name, scheduler& sched, journal& j) {
+    auto last = j.last_seq();
+    uint32_t space;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        space = static_cast<uint32_t>(sources_.size());
+        sources_.push_back({name, &sched, &j});
+        pending_.emplace_back();
+        appended_.push_back(last);
+    }
+    j.tap([this, space](const journal_record& rec) {
+        std::lock_guard<std::mutex> lck(m_);
+        pending_[space].push_back(rec);
+        appended_[space] = rec.seq;
+    });
+};
+
+replica_stats replicator::stats(const std::string& name) {
+    size_t space;
+    uint64_t appended;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        auto itr = std::find_if(sources_.begin(), sources_.end(),
+                                [&](const source& s) { return s.name == name; });
+        if (itr == sources_.end())
+            return {0, 0, 0};
+        space = itr - sources_.begin();
+        appended = appended_[space];
+    }
+    std::lock_guard<std::mutex> lck(followers_m_);
+    replica_stats ret{followers_.size(), 0, 0};
+    auto now = std::chrono::steady_clock::now();
+    for (auto& f:followers_) {
+        if (space >= f.acked.size() || f.acked[space] >= appended)
+            continue;
+        ret.lag_records = std::max(ret.lag_records, appended - f.acked[space]);
+        std::chrono::duration<double> behind = now - f.caught_up;
+        ret.lag_seconds = std::max(ret.lag_seconds, behind.count());
+    }
+    return ret;
+};
+
+// wakes every batch_window to pick up what was tapped meanwhile, so an
+// append never has to make a system call to get it going
+void replicator::run() {
+    using std::chrono::steady_clock;
+    std::vector<std::vector<journal_record>> batch;
+    std::vector<uint64_t> last;
+    std::vector<pollfd> fds;
+    auto sent = steady_clock::now();
+    for (;;) {
+        fds.clear();
+        fds.push_back({wake_[0], POLLIN, 0});
+        fds.push_back({listen_fd_, POLLIN, 0});
+        for (auto& f:followers_)
+            fds.push_back({f.fd, static_cast<short>(f.out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        if (::poll(fds.data(), fds.size(), static_cast<int>(batch_window.count())) < 0 &&
+            errno != EINTR)
+            return;
+        if (fds[0].revents)
+            return;
+
+        std::lock_guard<std::mutex> lck(followers_m_);
+        size_t spaces;
+        {
+            std::lock_guard<std::mutex> lck(m_);
+            spaces = sources_.size();
+        }
+        for (size_t i = 0; i != followers_.size(); ++i) {
+            auto ev = fds[i + 2].revents;
+            auto& f = followers_[i];
+            if (ev & (POLLIN | POLLHUP | POLLERR))
+                read_acks(f);
+            // a namespace added since
+            if (f.fd >= 0 && !f.resyncing && f.from.size() < spaces)
+                start_snapshots(f, spaces);
+            if (f.fd >= 0 && !f.jobs.empty())
+                finish_snapshots(f);
+            if (f.fd >= 0 && !f.out.empty() && (ev & POLLOUT))
+                write_to(f);
+        }
+        if (fds[1].revents & POLLIN)
+            accept_all();
+
+        bool any = false;
+        {
+            std::lock_guard<std::mutex> lck(m_);
+            batch.resize(pending_.size());
+            for (size_t space = 0; space != batch.size(); ++space) {
+                batch[space].swap(pending_[space]);
+                any = any || !batch[space].empty();
+            }
+            last = appended_;
+        }
+        auto now = steady_clock::now();
+        bool beat = now - sent >= heartbeat;
+        if (any || beat) {
+            send(batch, last, beat);
+            for (auto& b:batch)
+                b.clear();
+            sent = now;
+        }
+        for (size_t i = 0; i != followers_.size(); ) {
+            auto& f = followers_[i];
+            if (f.fd >= 0 && !f.resyncing && backlog(f) > max_backlog)
+                resync(f);
+            if (f.fd < 0) {
+                drop(f);
+                if (i + 1 != followers_.size())
+                    f = std::move(followers_.back());
+                followers_.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+};
+
+// a new follower starts with snapshots taken right now, the records they
+// cover are skipped when they come by
+void replicator::accept_all() {
+    size_t spaces;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        spaces = sources_.size();
+    }
+    for (;;) {
+        int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        follower f{fd, {}, {}, std::string{magic, sizeof(magic)}, std::string{},
+                   std::chrono::steady_clock::now(), {}, {{sizeof(magic), false}}, 0, false};
+        start_snapshots(f, spaces);
+        followers_.push_back(std::move(f));
+    }
+};
+
+// a child writes the snapshot of every namespace the follower does not
+// have yet to a file, the records that come meanwhile queue up behind it
+void replicator::start_snapshots(follower& f, size_t spaces) {
+    std::vector<source> sources;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        sources.assign(sources_.begin(), sources_.begin() + spaces);
+    }
+    for (auto space = f.from.size(); space != spaces; ++space) {
+        f.from.push_back(0);
+        f.acked.push_back(0);
+        char name[] = "/tmp/spclock-replica-XXXXXX";
+        int tmp = ::mkstemp(name);
+        if (tmp < 0) {
+            ::close(f.fd);
+            f.fd = -1;
+            return;
+        }
+        ::unlink(name);
+        snapshot_job job{static_cast<uint32_t>(space), 0, tmp, std::string{}, {}};
+        try {
+            job.pid = sources[space].sched->dump(tmp, f.from[space]);
+        } catch (std::exception&) {
+            ::close(tmp);
+            ::close(f.fd);
+            f.fd = -1;
+            return;
+        }
+        f.acked[space] = f.from[space];
+        f.jobs.push_back(std::move(job));
+    }
+};
+
+// the same batches go to everyone, minus what its snapshots covered
+// already. an empty one of the first namespace is the heartbeat
+void replicator::send(std::vector<std::vector<journal_record>>& batch,
+                      const std::vector<uint64_t>& last, bool beat) {
+    std::string frame;
+    for (auto& f:followers_) {
+        if (f.fd < 0 || f.resyncing)
+            continue;
+        for (uint32_t space = 0; space != batch.size() && space != f.from.size(); ++space) {
+            auto& recs = batch[space];
+            auto first = std::find_if(recs.begin(), recs.end(),
+                             [&](const journal_record& r) { return r.seq > f.from[space]; });
+            auto count = static_cast<uint32_t>(recs.end() - first);
+            if (!count && !(beat && space == 0))
+                continue;
+            frame.clear();
+            append(frame, frame_header{count, space, last[space]});
+            frame.append(reinterpret_cast<const char*>(&*first),
+                         count * sizeof(journal_record));
+            queue(f, space, frame, false);
+        }
+        write_to(f);
+    }
+};
+
+// a namespace with its snapshot still being written holds its records
+// back until the snapshot is out
+void replicator::queue(follower& f, uint32_t space, const std::string& frame,
+                       bool snapshot) {
+    for (auto& job:f.jobs) {
+        if (job.space == space && !snapshot) {
+            job.held += frame;
+            job.held_frames.push_back(frame.size());
+            return;
+        }
+    }
+    f.out += frame;
+    f.frames.push_back({frame.size(), snapshot});
+    if (snapshot)
+        f.snapshot_bytes += frame.size();
+};
+
+// a follower acknowledges every batch with the last record it applied
+void replicator::read_acks(follower& f) {
+    char buf[read_size];
+    auto n = ::read(f.fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (n <= 0) {
+        ::close(f.fd);
+        f.fd = -1;
+        return;
+    }
+    f.in.append(buf, n);
+    size_t off = 0;
+    for (; f.in.size() - off >= sizeof(ack); off += sizeof(ack)) {
+        ack a;
+        std::memcpy(&a, f.in.data() + off, sizeof(a));
+        if (a.space < f.acked.size())
+            f.acked[a.space] = std::max(f.acked[a.space], a.seq);
+    }
+    f.in.erase(0, off);
+    std::lock_guard<std::mutex> lck(m_);
+    for (size_t space = 0; space != f.acked.size(); ++space)
+        if (f.acked[space] < appended_[space])
+            return;
+    f.caught_up = std::chrono::steady_clock::now();
+};
+
+// once a child is done its snapshot goes out, and what was held back
+// for it after it
+void replicator::finish_snapshots(follower& f) {
+    for (size_t i = 0; i != f.jobs.size(); ) {
+        auto& job = f.jobs[i];
+        int status = 0;
+        auto r = ::waitpid(job.pid, &status, WNOHANG);
+        if (r == 0 || (r < 0 && errno == EINTR)) {
+            ++i;
+            continue;
+        }
+        job.pid = 0;
+        bool ok = r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        std::string name;
+        {
+            std::lock_guard<std::mutex> lck(m_);
+            name = sources_[job.space].name;
+        }
+        std::string frame;
+        auto size = ok ? ::lseek(job.fd, 0, SEEK_END) : -1;
+        if (size >= 0) {
+            frame.reserve(sizeof(frame_header) + sizeof(snapshot_header) + name.size() + size);
+            append(frame, frame_header{snapshot_count, job.space, f.from[job.space]});
+            append(frame, snapshot_header{static_cast<uint64_t>(size),
+                                          static_cast<uint32_t>(name.size()), 0});
+            frame += name;
+            auto at = frame.size();
+            frame.resize(at + size);
+            ok = ::pread(job.fd, &frame[at], size, 0) == size;
+        } else {
+            ok = false;
+        }
+        ::close(job.fd);
+        job.fd = -1;
+        if (!ok) {
+            ::close(f.fd);
+            f.fd = -1;
+            return;
+        }
+        auto space = job.space;
+        auto held = std::move(job.held);
+        auto held_frames = std::move(job.held_frames);
+        f.jobs.erase(f.jobs.begin() + i);
+        queue(f, space, frame, true);
+        f.out += held;
+        for (auto n:held_frames)
+            f.frames.push_back({n, false});
+    }
+    write_to(f);
+};
+
+// what waits for the follower, but for the snapshots
+size_t replicator::backlog(const follower& f) const {
+    auto ret = f.out.size() - f.snapshot_bytes;
+    for (auto& job:f.jobs)
+        ret += job.held.size();
+    return ret;
+};
+
+// keeps only the rest of the frame halfway out, so the stream stays whole,
+// and ends it with a resync. snapshots still being written are not needed
+// any more
+void replicator::resync(follower& f) {
+    stop_snapshots(f);
+    auto keep = f.frames.empty() ? frame{0, false} : f.frames.front();
+    f.out.resize(keep.left);
+    f.frames.clear();
+    f.snapshot_bytes = keep.snapshot ? keep.left : 0;
+    if (keep.left)
+        f.frames.push_back(keep);
+    append(f.out, frame_header{resync_count, 0, 0});
+    f.frames.push_back({sizeof(frame_header), false});
+    f.resyncing = true;
+    write_to(f);
+};
+
+// children still writing snapshots for it are not needed any more
+void replicator::stop_snapshots(follower& f) {
+    for (auto& job:f.jobs) {
+        if (job.pid) {
+            ::kill(job.pid, SIGKILL);
+            while (::waitpid(job.pid, nullptr, 0) < 0 && errno == EINTR)
+                ;
+        }
+        if (job.fd >= 0)
+            ::close(job.fd);
+    }
+    f.jobs.clear();
+};
+
+void replicator::drop(follower& f) {
+    stop_snapshots(f);
+    if (f.fd >= 0)
+        ::close(f.fd);
+    f.fd = -1;
+};
+
+void replicator::write_to(follower& f) {
+    if (f.fd < 0)
+        return;
+    size_t off = 0;
+    while (off != f.out.size()) {
+        auto n = ::write(f.fd, f.out.data() + off, f.out.size() - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            ::close(f.fd);
+            f.fd = -1;
+            f.out.clear();
+            return;
+        }
+        off += n;
+    }
+    f.out.erase(0, off);
+    while (off) {
+        auto& fr = f.frames.front();
+        auto n = std::min(off, fr.left);
+        off -= n;
+        fr.left -= n;
+        if (fr.snapshot)
+            f.snapshot_bytes -= n;
+        if (!fr.left)
+            f.frames.pop_front();
+    }
+    if (f.resyncing && f.out.empty()) {
+        ::close(f.fd);
+        f.fd = -1;
+    }
+};
+
+namespace {
+// reads size bytes of a snapshot into the file, the way the scheduler
+// writes its own. false if they do not all come, throws if the file
+// cannot be written
+bool take_snapshot(int fd, uint64_t size, const std::string& snapshot,
+                   std::chrono::milliseconds timeout) {
+    auto tmp = snapshot + ".tmp";
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        fail("Cannot create snapshot " + tmp);
+    char buf[read_size];
+    bool got = true, put = true;
+    for (uint64_t left = size; got && put && left; ) {
+        auto n = std::min<uint64_t>(left, sizeof(buf));
+        got = read_full(fd, buf, n, timeout);
+        put = got && write_full(out, buf, n);
+        left -= n;
+    }
+    put = put && fsync(out) == 0;
+    ::close(out);
+    if (got && put && ::rename(tmp.c_str(), snapshot.c_str()) == 0) {
+        sync_dir(snapshot);
+        return true;
+    }
+    ::unlink(tmp.c_str());
+    if (got)
+        fail("Cannot write snapshot " + snapshot);
+    return false;
+}
+}
+
+// the leader counts as gone once connecting to it has not worked for
+// timeout since the stream last ended. namespace indexes only hold for
+// one connection, the names for good
+size_t follow(const std::string& path,
+              const std::function<std::string(const std::string&)>& snapshot_of,
+              const std::function<scheduler&(const std::string&)>& start,
+              std::chrono::milliseconds timeout) {
+    using std::chrono::steady_clock;
+    std::signal(SIGPIPE, SIG_IGN);
+    std::vector<std::string> followed;
+    auto lost = steady_clock::now();
+    std::vector<scheduler*> spaces;
+    std::vector<uint64_t> applied;
+    std::vector<journal_record> recs;
+    std::string name;
+    for (;;) {
+        int fd = connect_socket(path);
+        if (fd < 0 && followed.empty())
+            fail("Cannot connect to the leader at " + path);
+        char m[sizeof(magic)];
+        if (fd >= 0 && (!read_full(fd, m, sizeof(m), timeout) ||
+                        std::memcmp(m, magic, sizeof(magic)) != 0)) {
+            ::close(fd);
+            fd = -1;
+            if (followed.empty())
+                throw std::runtime_error("Not a leader: " + path);
+        }
+        if (fd < 0) {
+            if (steady_clock::now() - lost >= timeout)
+                return followed.size();
+            std::this_thread::sleep_for(reconnect_pause);
+            continue;
+        }
+
+        // frames until the stream ends, goes silent or asks for a resync
+        spaces.clear();
+        applied.clear();
+        try {
+            for (;;) {
+                frame_header h;
+                if (!read_full(fd, reinterpret_cast<char*>(&h), sizeof(h), timeout) ||
+                    h.count == resync_count)
+                    break;
+                if (h.count == snapshot_count) {
+                    snapshot_header sh;
+                    if (!read_full(fd, reinterpret_cast<char*>(&sh), sizeof(sh), timeout))
+                        break;
+                    name.resize(sh.name_size);
+                    if (!read_full(fd, &name[0], name.size(), timeout) ||
+                        !take_snapshot(fd, sh.size, snapshot_of(name), timeout))
+                        break;
+                    if (spaces.size() <= h.space) {
+                        spaces.resize(h.space + 1, nullptr);
+                        applied.resize(h.space + 1, 0);
+                    }
+                    spaces[h.space] = &start(name);
+                    applied[h.space] = h.last;
+                    if (std::find(followed.begin(), followed.end(), name) == followed.end())
+                        followed.push_back(name);
+                    continue;
+                }
+                // a batch ahead of its snapshot is not from a leader
+                if (h.space >= spaces.size() || !spaces[h.space])
+                    break;
+                recs.resize(h.count);
+                if (!read_full(fd, reinterpret_cast<char*>(recs.data()),
+                               h.count * sizeof(journal_record), timeout))
+                    break;
+                for (auto& rec:recs) {
+                    spaces[h.space]->follow(rec);
+                    applied[h.space] = rec.seq;
+                }
+                ack a{h.space, 0, applied[h.space]};
+                if (!write_full(fd, reinterpret_cast<const char*>(&a), sizeof(a)))
+                    break;
+            }
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (followed.empty())
+            throw std::runtime_error("Cannot take over the snapshots from " + path);
+        lost = steady_clock::now();
+    }
+};
+
+} // namespace spclock
@@ -0,0 +1,124 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "journal.h"
+#include "scheduler.h"
+
+namespace spclock {
+
+struct replica_stats {
+    size_t followers;
+    // of the follower furthest behind. seconds count from the last time it
+    // had everything, zero while it does
+    uint64_t lag_records;
+    double lag_seconds;
+};
+
+// leader side of hot standby replication, for every namespace added. a
+// follower connecting to the socket gets a snapshot of each namespace
+// first, written by a forked child so firing only waits for the fork,
+// then every journal record after it, marked with the namespace it is of.
+// records are tapped off the journals into a buffer and sent from a
+// thread of its own in batches, every batch_window at most. nothing on
+// the scheduler's side ever waits for a follower, one that falls too far
+// behind is told to resync and disconnected, it connects again for new
+// snapshots
+class replicator {
+public:
+    static constexpr std::chrono::milliseconds batch_window{5};
+    // sent when there is nothing else, so a follower can tell a silent
+    // leader from a dead one
+    static constexpr std::chrono::milliseconds heartbeat{100};
+
+    explicit replicator(const std::string& path);
+    ~replicator();
+    replicator(const replicator&) = delete;
+    replicator& operator=(const replicator&) = delete;
+
+    // streams the namespace from then on. followers there are already get
+    // a snapshot of it first. both have to outlive the replicator
+    void add(const std::string& name, scheduler&, journal&);
+    // of one namespace
+    replica_stats stats(const std::string& name);
+
+private:
+    struct source {
+        std::string name;
+        scheduler* sched;
+        journal* jrnl;
+    };
+    struct frame {
+        size_t left;
+        bool snapshot;   // does not count as backlog
+    };
+    // a child writing the snapshot of a namespace for a follower. records
+    // of the namespace wait behind it
+    struct snapshot_job {
+        uint32_t space;
+        int pid;
+        int fd;
+        std::string held;
+        std::vector<size_t> held_frames;
+    };
+    struct follower {
+        int fd;
+        std::vector<uint64_t> from;    // by namespace, what its snapshot covers
+        std::vector<uint64_t> acked;
+        std::string out;
+        std::string in;
+        std::chrono::steady_clock::time_point caught_up;
+        std::vector<snapshot_job> jobs;
+        std::deque<frame> frames;   // of what out holds, what is left of the first
+        size_t snapshot_bytes;      // of out
+        bool resyncing;             // closed once the resync frame is out
+    };
+
+    void run();
+    void accept_all();
+    void start_snapshots(follower&, size_t spaces);
+    void send(std::vector<std::vector<journal_record>>&, const std::vector<uint64_t>&, bool);
+    void queue(follower&, uint32_t space, const std::string&, bool snapshot);
+    void read_acks(follower&);
+    void write_to(follower&);
+    void finish_snapshots(follower&);
+    void resync(follower&);
+    size_t backlog(const follower&) const;
+    static void stop_snapshots(follower&);
+    static void drop(follower&);
+
+    std::string path_;
+    int listen_fd_;
+    int wake_[2];   // self pipe for the destructor
+    std::mutex m_;
+    std::vector<source> sources_;
+    std::vector<std::vector<journal_record>> pending_;   // tapped since the last batch
+    std::vector<uint64_t> appended_;                     // last record tapped
+    std::vector<follower> followers_;   // only the sender changes them
+    std::mutex followers_m_;
+    std::thread sender_;
+};
+
+// follower side. connects to the leader at path and saves the snapshot of
+// each namespace it sends to the file snapshot_of gives for its name, then
+// calls start, which has to attach a new scheduler of the namespace to it
+// and return that. from then on every record of the namespace goes to its
+// scheduler::follow(). a leader asking for a resync or going away gets
+// connected to again, each time for new snapshots and new schedulers.
+// returns the namespaces followed once that has not worked for timeout.
+// throws if there is no leader to begin with
+size_t follow(const std::string& path,
+              const std::function<std::string(const std::string&)>& snapshot_of,
+              const std::function<scheduler&(const std::string&)>& start,
+              std::chrono::milliseconds timeout);
+
+} // namespace spclock
+
+#endif
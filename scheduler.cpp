@@ -0,0 +1,1024 @@
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "scheduler.h"
+#include "snapshot.h"
+
+namespace spclock {
+
+// upper bound of a single wait, so resumes and clock changes get noticed
+constexpr seconds wake_interval{1};
+// a message handle the journal being replayed has not named
+constexpr message_pool::handle unmapped = UINT32_MAX;
+
+late_policy parse_late_policy(const std::string& str) {
+    if (str == "all")
+        return late_policy::fire_all;
+    if (str == "latest")
+        return late_policy::latest_only;
+    if (str == "drop")
+        return late_policy::drop_stale;
+    throw std::invalid_argument("Unknown late policy: " + str);
+};
+
+admission parse_admission(const std::string& str) {
+    if (str == "reject")
+        return admission::reject;
+    if (str == "block")
+        return admission::block;
+    throw std::invalid_argument("Unknown admission mode: " + str);
+};
+
+snapshot_mode parse_snapshot_mode(const std::string& str) {
+    if (str == "foreground")
+        return snapshot_mode::foreground;
+    if (str == "background")
+        return snapshot_mode::background;
+    throw std::invalid_argument("Unknown snapshot mode: " + str);
+};
+
+suspend_monitor::suspend_monitor() : last_{current_clock().suspended()} { };
+
+seconds suspend_monitor::poll() {
+    auto cur = current_clock().suspended();
+    auto ret = date::floor<seconds>(cur - last_);
+    last_ = cur;
+    return (ret > seconds{0}) ? ret : seconds{0};
+};
+
+scheduler::scheduler(fire_handler on_fire, sched_options opts)
+      :on_fire_{std::move(on_fire)}, opts_{opts}, journal_{nullptr},
+       bulk_hold_{INT64_MIN}, done_{false}, pending_{0},
+       pending_bytes_{0}, tokens_{std::max(1.0, opts.max_rate)},
+       refilled_{current_clock().now()}, admitted_{0}, rejected_{0}, fired_{0},
+       snapshots_{0}, snapshot_failures_{0}, snapshot_bytes_{0},
+       snapshot_ms_{0}, cow_faults_{0}, child_faults_{0}, snapshot_pid_{0},
+       status_{nullptr}, dirty_{false}, events_{nullptr}, space_{0},
+       standby_{false} {
+    for (auto& q:queues_)
+        q = make_queue(opts_.backend);
+    if (!current_clock().is_virtual())
+        worker_ = std::thread{&scheduler::run, this};
+}
+
+scheduler::~scheduler() {
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        done_ = true;
+    }
+    cv_.notify_one();
+    room_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+    // waits for a snapshot still being written
+    if (reaper_.joinable())
+        reaper_.join();
+}
+
+size_t scheduler::add(buzzer b) {
+    return add(std::move(b), defaults());
+};
+
+add_options scheduler::defaults() const {
+    return {opts_.admit, opts_.sync};
+};
+
+size_t scheduler::add(buzzer b, add_options ao) {
+    std::unique_lock<std::mutex> lck(m_);
+    admit(lck, b, ao.admit);
+    auto id = insert(b);
+    // the new buzzer may be the earliest one
+    cv_.notify_one();
+    auto seq = logged();
+    lck.unlock();
+    durable(seq, ao.sync);
+    return id;
+};
+
+std::vector<add_result> scheduler::add_batch(std::vector<buzzer> bs,
+                                             durability level) {
+    std::vector<add_result> ret;
+    ret.reserve(bs.size());
+    std::unique_lock<std::mutex> lck(m_);
+    for (auto& b:bs) {
+        try {
+            admit(lck, b, admission::reject);
+            ret.push_back({insert(b), std::string{}});
+        } catch (admission_error& e) {
+            ret.push_back({0, e.what()});
+        }
+    }
+    cv_.notify_one();
+    auto seq = logged();
+    lck.unlock();
+    durable(seq, level);
+    return ret;
+};
+
+// puts an admitted buzzer into the table and its queue, and logs it
+size_t scheduler::insert(buzzer& b) {
+    touch();
+    b.state = b_state::running;
+    ++pending_;
+    pending_bytes_ += b.message.size();
+    auto prio = static_cast<size_t>(b.priority);
+    auto id = table_.push(b);
+    queues_[prio]->push({table_.deadline(id), id});
+    record(log_event::added, id);
+
+    auto& meta = table_.meta(id);
+    auto zone = zone_index(meta.zone);
+    // a text nobody held before may have a handle of one gone, the journal
+    // gets it again. a new tag is interned after the message
+    bool fresh[2];
+    for (int i = 0; i != 2; ++i)
+        fresh[i] = table_.messages().acquire(i ? meta.tag : meta.message) == 1;
+    if (journal_) {
+        for (int i = 0; i != 2; ++i) {
+            auto h = i ? meta.tag : meta.message;
+            if (fresh[i]) {
+                auto text = table_.messages().get(h);
+                journal_->append_text(rec_op::intern, h, text.data, text.size);
+            }
+        }
+        journal_record rec{};
+        rec.op = rec_op::add;
+        rec.id = id;
+        rec.deadline = table_.deadline(id);
+        rec.ref = meta.message;
+        rec.zone = zone;
+        rec.arg = static_cast<uint8_t>(meta.buzzer_type);
+        rec.prio = static_cast<uint8_t>(meta.priority);
+        journal_->append(rec);
+        if (meta.tag != message_pool::empty) {
+            journal_record tr{};
+            tr.op = rec_op::tag;
+            tr.id = id;
+            tr.ref = meta.tag;
+            journal_->append(tr);
+        }
+    }
+    return id;
+};
+
+b_state scheduler::stop(size_t id) {
+    return stop(id, opts_.sync);
+};
+
+b_state scheduler::stop(size_t id, durability level) {
+    std::unique_lock<std::mutex> lck(m_);
+    if (id >= table_.size())
+        throw std::out_of_range("No buzzer with ID " + std::to_string(id));
+    auto old = table_.state(id);
+    if (old == b_state::running)
+        settle(id, b_state::cancelled);
+    else if (old == b_state::ringing)
+        settle(id, b_state::finished);
+    auto seq = logged();
+    lck.unlock();
+    durable(seq, level);
+    return old;
+};
+
+void scheduler::stop_all() {
+    std::unique_lock<std::mutex> lck(m_);
+    std::vector<size_t> ids;
+    table_.select_active(INT64_MIN, INT64_MAX, ids);
+    for (auto id:ids) {
+        if (table_.state(id) == b_state::running)
+            settle(id, b_state::cancelled);
+        else
+            settle(id, b_state::finished);
+    }
+    auto seq = logged();
+    lck.unlock();
+    durable(seq, opts_.sync);
+};
+
+b_state scheduler::snooze(size_t id, seconds dur) {
+    return snooze(id, dur, opts_.sync);
+};
+
+b_state scheduler::snooze(size_t id, seconds dur, durability level) {
+    if (dur <= seconds{0})
+        throw std::invalid_argument("Snooze time must be positive");
+    std::unique_lock<std::mutex> lck(m_);
+    if (id >= table_.size())
+        throw std::out_of_range("No buzzer with ID " + std::to_string(id));
+    auto old = table_.state(id);
+    if (old != b_state::running && old != b_state::ringing)
+        return old;
+
+    auto deadline = (date::floor<seconds>(current_clock().now()) + dur)
+                        .time_since_epoch().count();
+    // the old queue entry is skipped, its deadline no longer matches
+    table_.set_deadline(id, deadline);
+    settle(id, b_state::running);
+    queues_[static_cast<size_t>(table_.meta(id).priority)]->push({deadline, id});
+    log(rec_op::snooze, id, static_cast<uint8_t>(b_state::running), deadline);
+    emit(event_kind::snooze, id);
+    record(log_event::snoozed, id);
+    cv_.notify_one();
+    auto seq = logged();
+    lck.unlock();
+    durable(seq, level);
+    return old;
+};
+
+// sequence number of the last journal record, zero without a journal
+uint64_t scheduler::logged() const {
+    return journal_ ? journal_->last_seq() : 0;
+};
+
+// waits for the disk with the scheduler unlocked. follow() takes the
+// journal away for a moment, it is only looked at under the lock
+void scheduler::durable(uint64_t seq, durability level) {
+    if (level == durability::none || !seq)
+        return;
+    journal* j;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        j = journal_;
+    }
+    if (j)
+        j->commit(seq, level);
+};
+
+void scheduler::sync(durability level) {
+    std::unique_lock<std::mutex> lck(m_);
+    auto seq = logged();
+    lck.unlock();
+    durable(seq, level);
+};
+
+uint64_t scheduler::last_logged() const {
+    std::lock_guard<std::mutex> lck(m_);
+    return logged();
+};
+
+bool scheduler::is_durable(uint64_t seq, durability level) {
+    std::lock_guard<std::mutex> lck(m_);
+    return !journal_ || !seq || journal_->committed(seq, level);
+};
+
+void scheduler::set_limits(size_t pending, size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        opts_.max_pending = pending;
+        opts_.max_bytes = bytes;
+    }
+    room_.notify_all();
+};
+
+sched_stats scheduler::stats() const {
+    std::lock_guard<std::mutex> lck(m_);
+    sched_stats ret;
+    ret.pending = pending_;
+    ret.pending_bytes = pending_bytes_;
+    ret.pending_headroom = opts_.max_pending ?
+                           opts_.max_pending - std::min(pending_, opts_.max_pending) : 0;
+    ret.bytes_headroom = opts_.max_bytes ?
+                         opts_.max_bytes - std::min(pending_bytes_, opts_.max_bytes) : 0;
+    ret.max_pending = opts_.max_pending;
+    ret.max_bytes = opts_.max_bytes;
+    ret.rate_headroom = opts_.max_rate ? tokens_ : 0;
+    ret.admitted = admitted_;
+    ret.rejected = rejected_;
+    ret.fired = fired_;
+    ret.message_bytes = table_.messages().bytes();
+    ret.arena_bytes = table_.messages().arena_bytes();
+    ret.snapshots = snapshots_;
+    ret.snapshot_failures = snapshot_failures_;
+    ret.snapshot_bytes = snapshot_bytes_;
+    ret.snapshot_ms = snapshot_ms_;
+    ret.cow_faults = cow_faults_;
+    ret.child_faults = child_faults_;
+    return ret;
+};
+
+// waits for room in block mode. there is nobody to make room under a
+// virtual clock, so that always rejects
+void scheduler::admit(std::unique_lock<std::mutex>& lck, const buzzer& b,
+                      admission mode) {
+    auto bytes = b.message.size();
+    if (opts_.max_bytes && bytes > opts_.max_bytes) {
+        ++rejected_;
+        throw admission_error("Message is over the byte limit");
+    }
+    for (;;) {
+        refill();
+        const char* why = nullptr;
+        if (opts_.max_pending && pending_ >= opts_.max_pending)
+            why = "Too many pending buzzers";
+        else if (opts_.max_bytes && pending_bytes_ + bytes > opts_.max_bytes)
+            why = "Pending messages are over the byte limit";
+        else if (opts_.max_rate && tokens_ < 1)
+            why = "Too many buzzers added per second";
+        if (!why)
+            break;
+        if (done_ || mode == admission::reject ||
+            current_clock().is_virtual()) {
+            ++rejected_;
+            throw admission_error(why);
+        }
+
+        if (opts_.max_rate && tokens_ < 1) {
+            auto wait = std::chrono::duration<double>{(1 - tokens_) / opts_.max_rate};
+            room_.wait_for(lck, wait);
+        } else {
+            room_.wait(lck);
+        }
+    }
+    if (opts_.max_rate)
+        tokens_ -= 1;
+    ++admitted_;
+};
+
+// token bucket holding at most one second worth of inserts, and at least
+// one insert so a rate below one per second still lets some through
+void scheduler::refill() {
+    if (!opts_.max_rate)
+        return;
+    auto now = current_clock().now();
+    std::chrono::duration<double> elapsed = now - refilled_;
+    refilled_ = now;
+    tokens_ = std::min(std::max(1.0, opts_.max_rate),
+                       tokens_ + elapsed.count() * opts_.max_rate);
+};
+
+// every state change goes through here to keep the gauges right
+void scheduler::settle(size_t id, b_state state) {
+    touch();
+    auto old = table_.state(id);
+    auto live = [](b_state st) { return st == b_state::running || st == b_state::ringing; };
+    // running and ringing buzzers hold their texts in the pool
+    auto& pool = table_.messages();
+    if (!live(old) && live(state)) {
+        pool.acquire(table_.meta(id).message);
+        pool.acquire(table_.meta(id).tag);
+    }
+    if (old == b_state::running && state != b_state::running) {
+        --pending_;
+        pending_bytes_ -= table_.message(id).size;
+        room_.notify_all();
+    } else if (old != b_state::running && state == b_state::running) {
+        ++pending_;
+        pending_bytes_ += table_.message(id).size;
+    }
+    if (old == b_state::ringing && state != b_state::ringing)
+        ringing_.erase(id);
+    else if (old != b_state::ringing && state == b_state::ringing)
+        ringing_.insert(id);
+    table_.set_state(id, state);
+    if (state == b_state::ringing && old != b_state::ringing) {
+        ++fired_;
+        emit(event_kind::fire, id);
+        record(log_event::fired, id);
+    } else if (state == b_state::cancelled && old != b_state::cancelled) {
+        emit(event_kind::cancel, id);
+        record(log_event::cancelled, id);
+    } else if (state == b_state::finished && old == b_state::ringing) {
+        record(log_event::acknowledged, id);
+    }
+
+    // snoozes log themselves, they carry a new deadline
+    if (state == b_state::ringing || state == b_state::missed)
+        log(rec_op::fire, id, static_cast<uint8_t>(state));
+    else if (state != b_state::running)
+        log(rec_op::stop, id, static_cast<uint8_t>(state));
+
+    if (live(old) && !live(state)) {
+        pool.release(table_.meta(id).message);
+        pool.release(table_.meta(id).tag);
+        table_.forget_texts(id);
+    }
+};
+
+// wakes the scheduler thread once, it publishes the page in a moment
+void scheduler::touch() {
+    if (status_ && !dirty_) {
+        dirty_ = true;
+        cv_.notify_one();
+    }
+};
+
+void scheduler::publish_to(status_page* page) {
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        status_ = page;
+        dirty_ = false;
+        if (status_)
+            publish();
+    }
+    cv_.notify_one();
+};
+
+constexpr std::chrono::milliseconds scheduler::publish_interval;
+
+void scheduler::observe(event_handler h) {
+    std::lock_guard<std::mutex> lck(m_);
+    observer_ = std::move(h);
+};
+
+// what a standby follows has been told of by the leader
+void scheduler::emit(event_kind kind, size_t id) {
+    if (observer_ && !standby_)
+        observer_({kind, id, table_.deadline(id), table_.tag(id), table_.message(id)});
+};
+
+void scheduler::record_to(event_log* log, uint16_t space) {
+    std::lock_guard<std::mutex> lck(m_);
+    events_ = log;
+    space_ = space;
+};
+
+void scheduler::record(log_event e, size_t id) {
+    if (events_)
+        events_->record(e, space_, id, table_.deadline(id));
+};
+
+void scheduler::publish() {
+    status_data d;
+    std::memset(&d, 0, sizeof(d));
+    d.updated = date::floor<seconds>(current_clock().now()).time_since_epoch().count();
+    d.pending = pending_;
+    d.ringing = ringing_.size();
+    d.fired = fired_;
+    d.admitted = admitted_;
+    d.rejected = rejected_;
+    std::vector<deadline_entry> next;
+    earliest(status_slots, next);
+    d.next_count = next.size();
+    for (size_t i = 0; i != next.size(); ++i) {
+        d.next_id[i] = next[i].id;
+        d.next_deadline[i] = next[i].deadline;
+    }
+    for (auto id:ringing_) {
+        if (d.ringing_count == status_slots)
+            break;
+        d.ringing_id[d.ringing_count++] = id;
+    }
+    status_->publish(d);
+    dirty_ = false;
+    published_ = std::chrono::steady_clock::now();
+};
+
+// the first n running buzzers of every queue are popped and pushed back,
+// then the earliest n of them taken. entries of stopped or snoozed ones
+// met on the way stay popped, as in collect()
+void scheduler::earliest(size_t n, std::vector<deadline_entry>& out) {
+    std::vector<deadline_entry> taken;
+    for (auto& q:queues_) {
+        auto first = taken.size();
+        while (!q->empty() && taken.size() - first < n) {
+            auto top = q->top();
+            q->pop();
+            // a snooze to the same deadline leaves the entry twice
+            if (table_.state(top.id) != b_state::running ||
+                table_.deadline(top.id) != top.deadline ||
+                std::any_of(taken.begin() + first, taken.end(),
+                            [&](const deadline_entry& e) { return e.id == top.id; }))
+                continue;
+            taken.push_back(top);
+        }
+        for (auto i = first; i != taken.size(); ++i)
+            q->push(taken[i]);
+    }
+    std::sort(taken.begin(), taken.end(),
+              [](const deadline_entry& a, const deadline_entry& b) {
+                  return a.deadline < b.deadline ||
+                         (a.deadline == b.deadline && a.id < b.id);
+              });
+    if (taken.size() > n)
+        taken.resize(n);
+    out.swap(taken);
+};
+
+void scheduler::log(rec_op op, size_t id, uint8_t arg, int64_t deadline) {
+    if (!journal_)
+        return;
+    journal_record rec{};
+    rec.op = op;
+    rec.id = id;
+    rec.arg = arg;
+    rec.deadline = deadline;
+    journal_->append(rec);
+};
+
+uint16_t scheduler::zone_index(const date::time_zone* zone) {
+    auto itr = std::find(zones_.begin(), zones_.end(), zone);
+    if (itr != zones_.end())
+        return static_cast<uint16_t>(itr - zones_.begin());
+    zones_.push_back(zone);
+    if (journal_) {
+        auto& name = zone->name();
+        journal_->append_text(rec_op::zone, zones_.size() - 1,
+                              name.data(), name.size());
+    }
+    return static_cast<uint16_t>(zones_.size() - 1);
+};
+
+size_t scheduler::attach(journal& j, const std::string& snapshot) {
+    fire_batch ringing;
+    size_t n;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        snapshot_path_ = snapshot;
+        if (!snapshot.empty())
+            load(snapshot);
+        replay_state rs;
+        // left over by a background snapshot that did not finish
+        auto old = j.path() + ".old";
+        if (::access(old.c_str(), F_OK) == 0) {
+            journal prev{old};
+            prev.replay([&](const journal_record& rec) { apply(rec, rs); });
+        }
+        n = j.replay([&](const journal_record& rec) { apply(rec, rs); });
+        journal_ = &j;
+        if (!standby_)
+            ringing = ringing_batch();
+    }
+    cv_.notify_one();
+    if (!ringing.ids.empty())
+        on_fire_(std::move(ringing));
+    return n;
+};
+
+// every buzzer that is ringing now, as one batch
+fire_batch scheduler::ringing_batch() const {
+    fire_batch ret;
+    for (auto id:ringing_) {
+        ret.ids.push_back(id);
+        ret.priority = std::min(ret.priority, table_.meta(id).priority);
+    }
+    return ret;
+};
+
+void scheduler::standby(bool on) {
+    fire_batch ringing;
+    {
+        std::lock_guard<std::mutex> lck(m_);
+        if (standby_ && !on)
+            ringing = ringing_batch();
+        standby_ = on;
+    }
+    cv_.notify_one();
+    if (!ringing.ids.empty())
+        on_fire_(std::move(ringing));
+};
+
+// the record goes to the own journal as it is, applying it must not log
+// the changes it makes a second time
+void scheduler::follow(const journal_record& rec) {
+    std::lock_guard<std::mutex> lck(m_);
+    auto j = journal_;
+    auto events = events_;
+    journal_ = nullptr;
+    events_ = nullptr;
+    apply(rec, following_);
+    journal_ = j;
+    events_ = events;
+    if (journal_)
+        journal_->append(rec);
+};
+
+// the child sees the table as it was at the fork, like fork_snapshot()
+int scheduler::dump(int fd, uint64_t& covers) {
+    std::lock_guard<std::mutex> lck(m_);
+    covers = journal_ ? journal_->last_seq() : 0;
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot fork for a snapshot");
+    if (pid == 0) {
+        // nothing that allocates or locks
+        bool ok = spclock::write_snapshot(fd, table_, zones_) != 0;
+        _exit(ok ? 0 : 1);
+    }
+    return pid;
+};
+
+// records are applied idempotently, replaying one twice changes nothing
+void scheduler::apply(const journal_record& rec, replay_state& rs) {
+    switch (rec.op) {
+    case rec_op::intern:
+    case rec_op::zone: {
+        if (rec.deadline == 0)
+            rs.text.clear();
+        rs.text.append(rec.text, rec.len);
+        if (rs.text.size() < rec.id)
+            break;
+        if (rec.op == rec_op::intern) {
+            rs.messages.resize(std::max<size_t>(rs.messages.size(), rec.ref + 1),
+                               unmapped);
+            rs.messages[rec.ref] = table_.messages().intern(rs.text);
+        } else {
+            const date::time_zone* zone;
+            try {
+                zone = date::locate_zone(rs.text);
+            } catch (std::exception&) {
+                zone = date::current_zone();
+            }
+            rs.zones.resize(std::max<size_t>(rs.zones.size(), rec.ref + 1));
+            rs.zones[rec.ref] = zone;
+            zone_index(zone);
+        }
+        break;
+    }
+    case rec_op::add: {
+        if (rec.id < table_.size())
+            break;
+        // IDs missing in between belong to buzzers long gone
+        table_.skip(rec.id);
+        auto zone = rec.zone < rs.zones.size() ? rs.zones[rec.zone] : nullptr;
+        if (!zone)
+            zone = rec.zone < zones_.size() ? zones_[rec.zone] : date::current_zone();
+        auto msg = rec.ref < rs.messages.size() ? rs.messages[rec.ref] : unmapped;
+        if (msg == unmapped)
+            msg = rec.ref < table_.messages().count() ? rec.ref : message_pool::empty;
+        buzzer_meta meta{zone, msg,
+            static_cast<b_type>(rec.arg), static_cast<b_priority>(rec.prio)};
+        auto id = table_.push_row(rec.deadline, b_state::cancelled, meta);
+        settle(id, b_state::running);
+        queues_[rec.prio]->push({rec.deadline, id});
+        break;
+    }
+    case rec_op::tag: {
+        auto st = table_.state(rec.id);
+        if (st != b_state::running && st != b_state::ringing)
+            break;
+        auto tag = rec.ref < rs.messages.size() ? rs.messages[rec.ref] : unmapped;
+        if (tag == unmapped)
+            tag = rec.ref < table_.messages().count() ? rec.ref : message_pool::empty;
+        table_.messages().acquire(tag);
+        table_.messages().release(table_.meta(rec.id).tag);
+        table_.set_tag(rec.id, tag);
+        break;
+    }
+    case rec_op::stop:
+    case rec_op::fire:
+        if (table_.has(rec.id))
+            settle(rec.id, static_cast<b_state>(rec.arg));
+        break;
+    case rec_op::snooze:
+        if (table_.has(rec.id)) {
+            table_.set_deadline(rec.id, rec.deadline);
+            settle(rec.id, b_state::running);
+            queues_[static_cast<size_t>(table_.meta(rec.id).priority)]->push(
+                    {rec.deadline, rec.id});
+        }
+        break;
+    }
+};
+
+// fills the empty table from a snapshot. messages and zones get the same
+// handles and indexes they had when it was written
+void scheduler::load(const std::string& path) {
+    struct sink : snapshot_sink {
+        scheduler& s;
+        size_t ids_ = 0;
+
+        explicit sink(scheduler& sched) : s(sched) { }
+
+        void ids(size_t n) override { ids_ = n; }
+        void zone(const std::string& name) override {
+            const date::time_zone* z;
+            try {
+                z = date::locate_zone(name);
+            } catch (std::exception&) {
+                z = date::current_zone();
+            }
+            s.zones_.push_back(z);
+        }
+        void handles(size_t n) override { s.table_.messages().extend(n); }
+        void message(message_pool::handle h, const char* data, size_t size) override {
+            try {
+                s.table_.messages().place(h, data, size);
+            } catch (std::logic_error&) {
+                throw std::runtime_error("Snapshot repeats a message");
+            }
+        }
+        void row(const snapshot_row& r) override {
+            if (r.id < s.table_.size() || r.id >= ids_ ||
+                r.message >= s.table_.messages().count() ||
+                r.tag >= s.table_.messages().count())
+                throw std::runtime_error("Snapshot rows are out of place");
+            // IDs in between belong to buzzers long gone, they get no rows
+            s.table_.skip(r.id);
+            buzzer_meta meta{
+                r.zone < s.zones_.size() ? s.zones_[r.zone] : date::current_zone(),
+                r.message, r.buzzer_type, r.priority, r.tag};
+            auto id = s.table_.push_row(r.deadline, b_state::cancelled, meta);
+            s.settle(id, r.state);
+            if (r.state == b_state::running)
+                s.queues_[static_cast<size_t>(r.priority)]->push({r.deadline, id});
+        }
+    } in{*this};
+
+    if (table_.size() || table_.messages().count() > 1 || !zones_.empty())
+        throw std::logic_error("Snapshots only load into an empty scheduler");
+    if (read_snapshot(path, in))
+        table_.skip(in.ids_);
+};
+
+size_t scheduler::snapshot() {
+    std::lock_guard<std::mutex> lck(m_);
+    return take_snapshot();
+};
+
+size_t scheduler::take_snapshot() {
+    if (!journal_ || snapshot_path_.empty())
+        throw std::logic_error("There is no snapshot file");
+    if (snapshot_pid_)
+        return 0;
+    // what went since the last one need not be copied by a child either
+    table_.trim();
+    // after a failed background snapshot the old journal is still needed,
+    // only one taken in the foreground covers it
+    auto old = journal_->path() + ".old";
+    if (opts_.snapshots == snapshot_mode::background &&
+        ::access(old.c_str(), F_OK) != 0) {
+        fork_snapshot();
+        return 0;
+    }
+    return write_snapshot();
+};
+
+// written next to the old one and renamed over it, so a crash leaves one
+// or the other. the journal is emptied only once the new one is on disk
+size_t scheduler::write_snapshot() {
+    auto started = std::chrono::steady_clock::now();
+    auto tmp = snapshot_path_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot create snapshot " + tmp);
+    auto bytes = spclock::write_snapshot(fd, table_, zones_);
+    if (!bytes || fsync(fd) < 0) {
+        auto err = errno;
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw std::system_error(err, std::generic_category(),
+                                "Cannot write snapshot " + tmp);
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), snapshot_path_.c_str()) < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot rename snapshot " + tmp);
+    // the rename itself has to reach the disk before the records go
+    sync_dir(snapshot_path_);
+    journal_->reset();
+    ::unlink((journal_->path() + ".old").c_str());
+    ++snapshots_;
+    snapshot_bytes_ = bytes;
+    snapshot_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - started).count();
+    cow_faults_ = child_faults_ = 0;
+    return bytes;
+};
+
+// the journal moves aside to <journal>.old and the child writes the
+// table as it was at the fork, while the parent goes on and logs to a new
+// journal. pages the parent writes to meanwhile get copied by the kernel,
+// that is the whole cost on this side
+void scheduler::fork_snapshot() {
+    auto tmp = snapshot_path_ + ".tmp";
+    journal_->rotate(journal_->path() + ".old");
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        ++snapshot_failures_;
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot fork for a snapshot");
+    }
+    if (pid == 0) {
+        // nothing that allocates or locks from here on, the other threads
+        // are gone and left their locks as they were
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0 && spclock::write_snapshot(fd, table_, zones_) &&
+                  fsync(fd) == 0 && ::close(fd) == 0 &&
+                  ::rename(tmp.c_str(), snapshot_path_.c_str()) == 0;
+        _exit(ok ? 0 : 1);
+    }
+    if (reaper_.joinable())
+        reaper_.join();
+    snapshot_pid_ = pid;
+    reaper_ = std::thread{&scheduler::reap, this, pid, started, ru.ru_minflt};
+};
+
+// waits for the child, then the old journal can go
+void scheduler::reap(int pid, std::chrono::steady_clock::time_point started,
+                     long faults) {
+    int status = 0;
+    struct rusage child;
+    pid_t r;
+    while ((r = wait4(pid, &status, 0, &child)) < 0 && errno == EINTR)
+        ;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - started).count();
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+    bool ok = r == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    struct stat st;
+    if (ok) {
+        sync_dir(snapshot_path_);
+        ok = ::stat(snapshot_path_.c_str(), &st) == 0;
+    }
+
+    std::lock_guard<std::mutex> lck(m_);
+    if (ok) {
+        ::unlink((journal_->path() + ".old").c_str());
+        ++snapshots_;
+        snapshot_bytes_ = st.st_size;
+    } else {
+        ++snapshot_failures_;
+    }
+    snapshot_ms_ = ms;
+    cow_faults_ = self.ru_minflt - faults;
+    child_faults_ = (r == pid) ? child.ru_minflt : 0;
+    snapshot_pid_ = 0;
+};
+
+size_t scheduler::simulate(virtual_clock& vc, date::sys_seconds until) {
+    size_t delivered = 0;
+    std::unique_lock<std::mutex> lck(m_);
+    for (;;) {
+        auto batches = collect(date::floor<seconds>(vc.now()), monitor_.poll());
+        if (!batches.empty()) {
+            delivered += batches.size();
+            lck.unlock();
+            for (auto& b:batches)
+                on_fire_(std::move(b));
+            lck.lock();
+        }
+        auto next = next_deadline();
+        if (!next || *next > until)
+            break;
+        vc.advance_to(*next);
+    }
+    vc.advance_to(until);
+    return delivered;
+};
+
+void scheduler::run() {
+    using std::chrono::system_clock;
+    std::unique_lock<std::mutex> lck(m_);
+    while (!done_) {
+        auto wake = system_clock::now() + wake_interval;
+        // compared in whole seconds, a far deadline does not fit in the
+        // clock's nanoseconds
+        auto next = next_deadline();
+        if (next && *next < date::ceil<seconds>(wake) && !standby_)
+            wake = *next;
+        if (dirty_) {
+            // the steady clock is what spaces publishes out
+            auto due = published_ + publish_interval - std::chrono::steady_clock::now();
+            auto at = system_clock::now() +
+                      std::chrono::duration_cast<system_clock::duration>(due);
+            if (at < wake)
+                wake = at;
+        }
+        cv_.wait_until(lck, wake);
+        if (done_)
+            break;
+        if (dirty_ && std::chrono::steady_clock::now() >= published_ + publish_interval)
+            publish();
+        // a failed snapshot leaves the journal as it is, the next wake
+        // tries again
+        if (opts_.snapshot_every && journal_ && !snapshot_path_.empty() &&
+            journal_->records() >= opts_.snapshot_every) {
+            try {
+                take_snapshot();
+            } catch (std::exception&) {
+            }
+        }
+        if (standby_)
+            continue;
+
+        auto batches = collect(
+               date::floor<seconds>(current_clock().now()), monitor_.poll());
+        if (batches.empty())
+            continue;
+        // the handler may call back into the scheduler
+        lck.unlock();
+        for (auto& b:batches)
+            on_fire_(std::move(b));
+        lck.lock();
+    }
+};
+
+// nothing if every queue is empty. deferred bulk buzzers count from when
+// the slack of the first one runs out, a pass for anything else before
+// then picks them up as well
+std::optional<date::sys_seconds> scheduler::next_deadline() {
+    std::optional<date::sys_seconds> ret;
+    for (size_t p = 0; p != queues_.size(); ++p) {
+        auto& q = *queues_[p];
+        if (q.empty())
+            continue;
+        auto deadline = q.top().deadline;
+        if (static_cast<b_priority>(p) == b_priority::bulk)
+            deadline = std::max(deadline, bulk_hold_);
+        if (!ret || deadline < ret->time_since_epoch().count())
+            ret = date::sys_seconds{seconds{deadline}};
+    }
+    return ret;
+};
+
+// pops every due buzzer in one pass, critical ones first. once max_batch
+// buzzers are handled, due bulk ones wait for a later pass unless their
+// slack ran out. that pass comes when the slack of the first one runs out
+// or something else goes off, whichever is earlier. after a resume the
+// overdue ones are coalesced into one batch according to the late policy
+std::vector<fire_batch> scheduler::collect(date::sys_seconds now,
+                                           seconds suspended) {
+    std::vector<fire_batch> ret;
+    fire_batch late;
+    late.suspended = suspended;
+    bool resumed = suspended >= opts_.resume_threshold;
+    size_t latest = 0;
+    size_t budget = opts_.max_batch;
+
+    for (size_t p = 0; p != queues_.size(); ++p) {
+        auto prio = static_cast<b_priority>(p);
+        auto& q = *queues_[p];
+        auto until = now.time_since_epoch().count();
+        if (prio == b_priority::bulk) {
+            // deferred ones wait out the hold unless something else went
+            // off in this pass
+            if (until < bulk_hold_ && budget == opts_.max_batch)
+                continue;
+            bulk_hold_ = INT64_MIN;
+        }
+        // entries of stopped or snoozed buzzers are dropped here
+        while (!q.empty() && q.top().deadline <= until) {
+            auto top = q.top();
+            auto id = top.id;
+            if (table_.state(id) != b_state::running ||
+                table_.deadline(id) != top.deadline) {
+                q.pop();
+                continue;
+            }
+            if (prio == b_priority::bulk && budget == 0 &&
+                top.deadline + opts_.bulk_slack.count() > until) {
+                bulk_hold_ = top.deadline + opts_.bulk_slack.count();
+                break;
+            }
+            q.pop();
+            if (budget > 0)
+                --budget;
+
+            if (resumed && until - top.deadline > opts_.late_tolerance.count()) {
+                // under latest_only the latest so far stays running until
+                // it rings below, only the ones it beats are missed
+                bool keep = opts_.late == late_policy::latest_only;
+                if (keep && late.overdue && id == latest)
+                    continue;   // a second entry of it
+                record(log_event::late, id);
+                if (late.overdue == 0 || table_.deadline(latest) < top.deadline) {
+                    if (keep && late.overdue)
+                        settle(latest, b_state::missed);
+                    latest = id;
+                } else {
+                    keep = false;
+                }
+                ++late.overdue;
+                if (prio < late.priority)
+                    late.priority = prio;
+                if (opts_.late == late_policy::fire_all) {
+                    settle(id, b_state::ringing);
+                    late.ids.push_back(id);
+                } else if (!keep) {
+                    settle(id, b_state::missed);
+                }
+            } else {
+                settle(id, b_state::ringing);
+                fire_batch fb;
+                fb.ids.push_back(id);
+                fb.priority = prio;
+                ret.push_back(std::move(fb));
+            }
+        }
+    }
+
+    if (late.overdue > 0) {
+        if (opts_.late == late_policy::latest_only) {
+            settle(latest, b_state::ringing);
+            late.ids.push_back(latest);
+            late.priority = table_.meta(latest).priority;
+        }
+        ret.insert(ret.begin(), std::move(late));
+    }
+    return ret;
+};
+
+} // namespace spclock
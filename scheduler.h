@@ -0,0 +1,308 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include "spclock.h"
+#include "clock.h"
+#include "queues.h"
+#include "table.h"
+#include "journal.h"
+#include "status.h"
+#include "events.h"
+#include "eventlog.h"
+
+namespace spclock {
+
+// what to do with buzzers that went off while the machine was suspended
+enum class late_policy {
+    fire_all,     // ring every overdue buzzer
+    latest_only,  // ring the most recent one, the others are missed
+    drop_stale    // overdue buzzers are missed, nothing rings
+};
+
+late_policy parse_late_policy(const std::string&);
+
+// what add() does when a limit is reached
+enum class admission {
+    reject,  // throw admission_error
+    block    // wait until there is room again
+};
+
+admission parse_admission(const std::string&);
+
+// how snapshots get written
+enum class snapshot_mode {
+    foreground,  // under the scheduler lock, firing waits for it
+    background   // by a forked child from its copy on write view
+};
+
+snapshot_mode parse_snapshot_mode(const std::string&);
+
+class admission_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+struct sched_options {
+    late_policy late = late_policy::fire_all;
+    // boottime running ahead of monotonic time by this much means a resume
+    seconds resume_threshold{30};
+    // after a resume, buzzers later than this are overdue
+    seconds late_tolerance{5};
+    // buzzers handled in one pass before due bulk ones get deferred
+    size_t max_batch = 256;
+    // how long a due bulk buzzer may be deferred
+    seconds bulk_slack{60};
+
+    // admission limits, zero means unlimited
+    size_t max_pending = 0;
+    size_t max_bytes = 0;   // message bytes of all pending buzzers
+    double max_rate = 0;    // inserts per second
+    admission admit = admission::reject;
+    // what changes wait for when there is a journal
+    durability sync = durability::batched;
+
+    queue_kind backend = queue_kind::heap;
+    // journal records that trigger a snapshot, zero means only on request
+    size_t snapshot_every = 0;
+    snapshot_mode snapshots = snapshot_mode::background;
+};
+
+// per call overrides of the defaults in sched_options
+struct add_options {
+    admission admit;
+    durability sync;
+};
+
+// outcome of one add of a batch, error is empty if it was admitted
+struct add_result {
+    size_t id;
+    std::string error;
+};
+
+// gauges for sizing hosts, headroom is zero for unlimited resources
+struct sched_stats {
+    size_t pending;
+    size_t pending_bytes;
+    size_t pending_headroom;
+    size_t bytes_headroom;
+    size_t max_pending;     // the limits, zero for unlimited
+    size_t max_bytes;
+    double rate_headroom;   // inserts available right now
+    size_t admitted;
+    size_t rejected;
+    size_t fired;
+    // distinct texts held, and the arena they take with dead ones in it
+    size_t message_bytes;
+    size_t arena_bytes;
+    size_t snapshots;
+    size_t snapshot_failures;
+    // of the last one. page faults are minor ones, in the parent they are
+    // mostly pages copied because the child still shared them
+    size_t snapshot_bytes;
+    size_t snapshot_ms;
+    size_t cow_faults;
+    size_t child_faults;
+};
+
+// buzzers going off together, delivered as a single notification
+struct fire_batch {
+    std::vector<size_t> ids;  // buzzers that are now ringing
+    size_t overdue = 0;       // buzzers found late after a resume
+    seconds suspended{0};     // time spent suspended, zero if no resume
+    b_priority priority = b_priority::bulk;  // highest class in the batch
+};
+
+// measures time the machine spent suspended between two polls
+class suspend_monitor {
+    std::chrono::nanoseconds last_;
+
+public:
+    suspend_monitor();
+    seconds poll();
+};
+
+// owns all buzzers and a single thread waiting on the earliest deadline.
+// every priority class has its own deadline queue, due critical buzzers
+// are always delivered first.
+// with a virtual clock there is no thread, simulate() drives it instead
+class scheduler {
+public:
+    using fire_handler = std::function<void(fire_batch)>;
+    using event_handler = std::function<void(const sched_event&)>;
+
+    explicit scheduler(fire_handler, sched_options = sched_options{});
+    ~scheduler();
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    // throws admission_error when a limit is hit in reject mode
+    size_t add(buzzer);
+    size_t add(buzzer, add_options);
+    // adds all of them under one lock and waits for the disk once. a
+    // buzzer over a limit is rejected on its own, block mode is ignored
+    std::vector<add_result> add_batch(std::vector<buzzer>, durability);
+    add_options defaults() const;
+    // running buzzers get cancelled, ringing ones finished.
+    // returns the state before the call, throws on unknown IDs
+    b_state stop(size_t);
+    b_state stop(size_t, durability);
+    void stop_all();
+    // moves a running or ringing buzzer to the given time from now.
+    // returns the state before the call, throws on unknown IDs and on
+    // times not after now
+    b_state snooze(size_t, seconds);
+    b_state snooze(size_t, seconds, durability);
+    // waits for everything changed so far, for callers that changed a
+    // lot with durability::none
+    void sync(durability);
+    // for callers that cannot wait: the journal record everything changed
+    // so far is up to, zero without a journal, and whether it is synced
+    // as the level asks for by now. throws like sync() on a failed sync
+    uint64_t last_logged() const;
+    bool is_durable(uint64_t, durability);
+    sched_stats stats() const;
+    // changes max_pending and max_bytes. buzzers already over a lowered
+    // limit stay, new ones wait for room
+    void set_limits(size_t pending, size_t bytes);
+
+    // loads the snapshot if there is one and replays the journal on top
+    // of it, every later change gets logged to the journal. meant to be
+    // called before any buzzer is added. buzzers that were ringing are
+    // delivered again. returns the records replayed
+    size_t attach(journal&, const std::string& snapshot = std::string{});
+
+    // on standby nothing fires, a follower gets every change through
+    // follow() instead. leaving it delivers the buzzers ringing by then,
+    // like attach() does
+    void standby(bool);
+    // applies a record of the leader's journal and logs it to the own one
+    void follow(const journal_record&);
+    // forks a child that writes a snapshot of the live buzzers to fd, for
+    // starting a follower, and exits with 0 once it did. the table is
+    // locked for the fork only. returns the child and sets the last
+    // journal record the snapshot covers, throws if it cannot fork
+    int dump(int fd, uint64_t& covers);
+
+    // writes the live buzzers to the snapshot file given to attach() and
+    // drops the journal records it covers. returns the snapshot size, or
+    // zero if it went to the background or one is running there already.
+    // throws on errors
+    size_t snapshot();
+
+    // keeps the page up to date from the scheduler thread, at most every
+    // publish_interval. null stops it
+    void publish_to(status_page*);
+    static constexpr std::chrono::milliseconds publish_interval{100};
+
+    // gets every fire, cancel and snooze from then on, with the scheduler
+    // locked, except on standby. it must not call back into the scheduler.
+    // null stops it
+    void observe(event_handler);
+    // records what happens to buzzers from then on under the given
+    // namespace index, except what a standby follows. null stops it
+    void record_to(event_log*, uint16_t space = 0);
+
+    // jumps the clock from deadline to deadline up to the given time,
+    // delivering batches on the calling thread. returns the batch count
+    size_t simulate(virtual_clock&, date::sys_seconds);
+
+    // calls f(buzzer_view) for every running or ringing buzzer due in
+    // [from, to), with the table locked
+    template <typename F>
+    void visit_active(F f, date::sys_seconds from = date::sys_seconds::min(),
+                      date::sys_seconds to = date::sys_seconds::max()) const {
+        std::vector<size_t> ids;
+        std::lock_guard<std::mutex> lck(m_);
+        table_.select_active(from.time_since_epoch().count(),
+                             to.time_since_epoch().count(), ids);
+        for (auto id:ids)
+            f(table_.view(id));
+    }
+
+private:
+    // texts and zones of a journal being replayed, by their journal index.
+    // ones the journal does not name came from the snapshot and kept theirs
+    struct replay_state {
+        std::string text;
+        std::vector<message_pool::handle> messages;
+        std::vector<const date::time_zone*> zones;
+    };
+
+    void run();
+    fire_batch ringing_batch() const;
+    void admit(std::unique_lock<std::mutex>&, const buzzer&, admission);
+    size_t insert(buzzer&);
+    void refill();
+    void settle(size_t, b_state);
+    void apply(const journal_record&, replay_state&);
+    void load(const std::string&);
+    size_t take_snapshot();
+    size_t write_snapshot();
+    void fork_snapshot();
+    void reap(int, std::chrono::steady_clock::time_point, long);
+    uint16_t zone_index(const date::time_zone*);
+    void log(rec_op, size_t, uint8_t, int64_t = 0);
+    uint64_t logged() const;
+    void durable(uint64_t, durability);
+    std::optional<date::sys_seconds> next_deadline();
+    void touch();
+    void publish();
+    void earliest(size_t, std::vector<deadline_entry>&);
+    void emit(event_kind, size_t);
+    void record(log_event, size_t);
+    std::vector<fire_batch> collect(date::sys_seconds, seconds);
+
+    fire_handler on_fire_;
+    sched_options opts_;
+    suspend_monitor monitor_;
+    buzzer_table table_;
+    std::vector<const date::time_zone*> zones_;
+    journal* journal_;
+    std::string snapshot_path_;
+    // indexed by b_priority
+    std::array<std::unique_ptr<deadline_queue>, 3> queues_;
+    // bulk buzzers deferred by the last pass are not retried before then
+    int64_t bulk_hold_;
+    bool done_;
+    size_t pending_;
+    size_t pending_bytes_;
+    std::set<size_t> ringing_;   // kept by settle(), lowest ID first
+    double tokens_;
+    clock_source::time_point refilled_;
+    size_t admitted_;
+    size_t rejected_;
+    size_t fired_;
+    size_t snapshots_;
+    size_t snapshot_failures_;
+    size_t snapshot_bytes_;
+    size_t snapshot_ms_;
+    size_t cow_faults_;
+    size_t child_faults_;
+    int snapshot_pid_;  // of the child writing one, zero if none
+    status_page* status_;
+    bool dirty_;        // changed since the page was published
+    std::chrono::steady_clock::time_point published_;
+    event_handler observer_;
+    event_log* events_;
+    uint16_t space_;
+    bool standby_;
+    replay_state following_;   // texts of the leader's journal
+    mutable std::mutex m_;
+    std::condition_variable cv_;
+    std::condition_variable room_;
+    std::thread worker_;
+    std::thread reaper_;
+};
+
+} // namespace spclock
+
+#endif
@@ -0,0 +1,65 @@
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "script.h"
+
+namespace spclock {
+
+namespace {
+[[noreturn]] void fail(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+}
+
+script_file::script_file(const std::string& path)
+      :data_{nullptr}, size_{0}, mapped_{false} {
+    bool std_in = (path == "-");
+    int fd = std_in ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        fail("Cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // read front to back once
+            ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(p);
+            size_ = st.st_size;
+            mapped_ = true;
+        }
+    }
+    // pipes, terminals and whatever cannot be mapped
+    if (!mapped_) {
+        char chunk[64 * 1024];
+        for (;;) {
+            auto n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                auto err = errno;
+                if (!std_in)
+                    ::close(fd);
+                errno = err;
+                fail("Cannot read " + path);
+            }
+            if (n == 0)
+                break;
+            buf_.append(chunk, n);
+        }
+        data_ = buf_.data();
+        size_ = buf_.size();
+    }
+    // a mapping stays valid after the descriptor is gone
+    if (!std_in)
+        ::close(fd);
+};
+
+script_file::~script_file() {
+    if (mapped_)
+        ::munmap(const_cast<char*>(data_), size_);
+}
+
+} // namespace spclock
@@ -0,0 +1,62 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace spclock {
+
+// the whole text of a file of commands. a regular file is mapped into
+// memory, anything else, like a pipe on stdin, is read into a buffer.
+// "-" is stdin. throws if it cannot be read
+class script_file {
+public:
+    explicit script_file(const std::string& path);
+    ~script_file();
+    script_file(const script_file&) = delete;
+    script_file& operator=(const script_file&) = delete;
+
+    std::string_view text() const { return {data_, size_}; }
+
+private:
+    const char* data_;
+    size_t size_;
+    bool mapped_;
+    std::string buf_;
+};
+
+// hands out the lines of a text as views into it, without the newline.
+// the newline is looked for with memchr, which compares a vector
+// register of bytes at a time instead of one byte
+class line_reader {
+public:
+    explicit line_reader(std::string_view text)
+          :text_{text}, pos_{0}, number_{0} { }
+
+    bool next(std::string_view& line) {
+        if (pos_ == text_.size())
+            return false;
+        auto start = text_.data() + pos_;
+        auto left = text_.size() - pos_;
+        auto nl = static_cast<const char*>(std::memchr(start, '\n', left));
+        size_t len = nl ? nl - start : left;
+        line = std::string_view{start, len};
+        pos_ += nl ? len + 1 : len;
+        ++number_;
+        return true;
+    }
+
+    // of the line last handed out, counting from one
+    size_t number() const { return number_; }
+
+private:
+    std::string_view text_;
+    size_t pos_;
+    size_t number_;
+};
+
+} // namespace spclock
+
+#endif
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+#include "protocol.h"
+
+namespace spclock {
+
+namespace {
+// a client sending more than this without a newline is cut off
+constexpr size_t max_line = 64 * 1024;
+constexpr size_t read_size = 64 * 1024;
+// a client this far behind on reading its replies is not read from
+constexpr size_t high_water = 1024 * 1024;
+
+[[noreturn]] void fail(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+void set_flags(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+sockaddr_un address(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("Socket path is too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+}
+
+int connect_socket(const std::string& path) {
+    auto addr = address(path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        fail("Cannot create socket");
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        auto err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+};
+
+int listen_socket(const std::string& path) {
+    // a socket file nobody answers on is left over from a crash
+    int probe = connect_socket(path);
+    if (probe >= 0) {
+        ::close(probe);
+        throw std::runtime_error("A daemon is already serving " + path);
+    }
+    ::unlink(path.c_str());
+
+    auto addr = address(path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        fail("Cannot create socket");
+    // only the owner may connect
+    auto mask = ::umask(077);
+    auto r = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    ::umask(mask);
+    if (r < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        auto err = errno;
+        ::close(fd);
+        errno = err;
+        fail("Cannot listen on " + path);
+    }
+    set_flags(fd);
+    return fd;
+};
+
+server::server(const std::string& path, line_handler handle,
+               frame_handler frames)
+      :path_{path}, handle_{std::move(handle)}, frames_{std::move(frames)},
+       listen_fd_{-1}, wake_{-1, -1} {
+    // a client going away halfway through its reply is not fatal
+    std::signal(SIGPIPE, SIG_IGN);
+
+    listen_fd_ = listen_socket(path);
+    if (::pipe(wake_) < 0) {
+        auto err = errno;
+        ::close(listen_fd_);
+        ::unlink(path.c_str());
+        errno = err;
+        fail("Cannot create pipe");
+    }
+    set_flags(wake_[0]);
+    set_flags(wake_[1]);
+};
+
+server::~server() {
+    for (auto& c:conns_)
+        ::close(c.fd);
+    ::close(listen_fd_);
+    ::close(wake_[0]);
+    ::close(wake_[1]);
+    ::unlink(path_.c_str());
+}
+
+// a zero byte on the pipe stops, any other one pokes. a full pipe
+// already has a wake pending
+void server::stop() {
+    char c = 0;
+    auto r = ::write(wake_[1], &c, 1);
+    (void)r;
+};
+
+void server::poke() {
+    char c = 1;
+    auto r = ::write(wake_[1], &c, 1);
+    (void)r;
+};
+
+void server::run() {
+    std::vector<pollfd> fds;
+    for (;;) {
+        fds.clear();
+        fds.push_back({wake_[0], POLLIN, 0});
+        fds.push_back({listen_fd_, POLLIN, 0});
+        for (auto& c:conns_) {
+            short events = (c.closing || c.s.out.size() > high_water) ? 0 : POLLIN;
+            if (!c.s.out.empty())
+                events |= POLLOUT;
+            fds.push_back({c.fd, events, 0});
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fail("Cannot poll");
+        }
+        bool poked = false;
+        if (fds[0].revents) {
+            char buf[64];
+            ssize_t n;
+            while ((n = ::read(wake_[0], buf, sizeof(buf))) > 0) {
+                if (std::memchr(buf, 0, n))
+                    return;
+                poked = true;
+            }
+        }
+
+        for (size_t i = 0; i != conns_.size(); ++i) {
+            auto ev = fds[i + 2].revents;
+            auto& c = conns_[i];
+            if (!c.closing && (ev & (POLLIN | POLLHUP | POLLERR)))
+                read_from(c);
+            if (!c.s.held.empty())
+                release(c);
+            bool wrote = false;
+            if (!c.s.out.empty() && (ev & (POLLOUT | POLLERR))) {
+                write_to(c);
+                wrote = true;
+            } else if (c.closing && (ev & (POLLHUP | POLLERR))) {
+                // the client is gone, so is its stream
+                c.s.out.clear();
+                c.s.held.clear();
+                c.s.feed = nullptr;
+            }
+            if (c.s.feed && (poked || wrote))
+                feed(c);
+        }
+        for (size_t i = 0; i != conns_.size(); ) {
+            auto& c = conns_[i];
+            if (c.closing && c.s.out.empty() && c.s.held.empty() && !c.s.feed) {
+                ::close(c.fd);
+                if (i + 1 != conns_.size())
+                    conns_[i] = std::move(conns_.back());
+                conns_.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        if (fds[1].revents & POLLIN)
+            accept_all();
+    }
+};
+
+void server::accept_all() {
+    for (;;) {
+        int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // EAGAIN, or out of descriptors until some get closed
+            return;
+        }
+        set_flags(fd);
+        conns_.push_back({fd, std::string{}, session{}, false, false, false});
+    }
+};
+
+// one read per wake so a chatty client cannot starve the others
+void server::read_from(conn& c) {
+    char buf[read_size];
+    auto n = ::read(c.fd, buf, sizeof(buf));
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        c.closing = true;
+        c.in.clear();
+        c.s.out.clear();
+        c.s.held.clear();
+        return;
+    }
+    if (n == 0)
+        c.closing = true;
+    c.in.append(buf, n);
+
+    // the first bytes tell the protocol, the magic may come in pieces
+    if (!c.sniffed) {
+        auto k = std::min(c.in.size(), sizeof(wire_magic));
+        bool magic = frames_ && std::memcmp(c.in.data(), wire_magic, k) == 0;
+        if (magic && k < sizeof(wire_magic) && !c.closing)
+            return;
+        c.sniffed = true;
+        if (magic && k == sizeof(wire_magic)) {
+            c.binary = true;
+            c.in.erase(0, k);
+        }
+    }
+    if (c.binary)
+        run_frames(c);
+    else
+        run_lines(c);
+};
+
+void server::run_lines(conn& c) {
+    size_t start = 0;
+    for (;;) {
+        auto nl = c.in.find('\n', start);
+        if (nl == std::string::npos)
+            break;
+        auto end = (nl > start && c.in[nl - 1] == '\r') ? nl - 1 : nl;
+        auto line = c.in.substr(start, end - start);
+        start = nl + 1;
+        auto held = c.s.held.size();
+        auto out = c.s.out.size();
+        bool more = handle_(line, c.s);
+        behind_held(c, held, out);
+        if (!more) {
+            c.closing = true;
+            c.in.clear();
+            return;
+        }
+    }
+    c.in.erase(0, start);
+    // the last line may come without a newline
+    if (c.closing && !c.in.empty()) {
+        auto held = c.s.held.size();
+        auto out = c.s.out.size();
+        handle_(c.in, c.s);
+        behind_held(c, held, out);
+        c.in.clear();
+    }
+    if (c.in.size() > max_line) {
+        c.s.out += "Line too long\n";
+        c.closing = true;
+        c.in.clear();
+    }
+};
+
+// every complete frame goes to the handler in one call. a malformed one
+// ends the connection, there is no telling where the next one starts
+void server::run_frames(conn& c) {
+    size_t end = 0;
+    try {
+        for (;;) {
+            auto n = frame_size(c.in.data() + end, c.in.size() - end);
+            if (n == 0 || end + n > c.in.size())
+                break;
+            end += n;
+        }
+        if (end) {
+            auto held = c.s.held.size();
+            auto out = c.s.out.size();
+            frames_(c.in.data(), end, c.s);
+            behind_held(c, held, out);
+        }
+    } catch (std::exception&) {
+        c.closing = true;
+        c.in.clear();
+        return;
+    }
+    c.in.erase(0, end);
+    if (c.closing)
+        c.in.clear();
+};
+
+void server::write_to(conn& c) {
+    size_t off = 0;
+    while (off != c.s.out.size()) {
+        auto n = ::write(c.fd, c.s.out.data() + off, c.s.out.size() - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            // gone, nobody to tell
+            c.closing = true;
+            c.s.out.clear();
+            c.s.held.clear();
+            c.s.feed = nullptr;
+            return;
+        }
+        off += n;
+    }
+    c.s.out.erase(0, off);
+};
+
+// what a handler appended to out while replies were held moves behind
+// the last of those
+void server::behind_held(conn& c, size_t held, size_t out) {
+    if (!held || c.s.out.size() == out)
+        return;
+    c.s.held[held - 1].text.append(c.s.out, out, std::string::npos);
+    c.s.out.resize(out);
+};
+
+void server::release(conn& c) {
+    auto& held = c.s.held;
+    while (!held.empty() && held.front().ready(held.front().text)) {
+        c.s.out += held.front().text;
+        held.pop_front();
+    }
+};
+
+// a stream gets no more than the client keeps up with, the rest stays
+// with whoever feeds it
+void server::feed(conn& c) {
+    if (c.s.out.size() > high_water)
+        return;
+    if (!c.s.feed(c.s.out)) {
+        c.s.feed = nullptr;
+        c.closing = true;
+        c.in.clear();
+    }
+};
+
+void call_server(const std::string& path, const std::string& line,
+                 std::ostream& out) {
+    std::signal(SIGPIPE, SIG_IGN);
+    int fd = connect_socket(path);
+    if (fd < 0)
+        fail("Cannot connect to " + path);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    auto req = line + '\n';
+    size_t off = 0;
+    char buf[read_size];
+    // the server stops reading from a client that leaves its replies unread
+    for (;;) {
+        pollfd pfd{fd, static_cast<short>(off != req.size() ? POLLIN | POLLOUT : POLLIN), 0};
+        if (::poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            auto n = ::read(fd, buf, sizeof(buf));
+            if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (n <= 0)
+                break;
+            // the reply may be a stream that never ends
+            out.write(buf, n);
+            out.flush();
+        }
+        if (off == req.size() || !(pfd.revents & POLLOUT))
+            continue;
+        auto n = ::write(fd, req.data() + off, req.size() - off);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n < 0 && !off) {
+            auto err = errno;
+            ::close(fd);
+            errno = err;
+            fail("Cannot send to " + path);
+        }
+        // a server that closed after quit answered all it is going to
+        off = (n < 0) ? req.size() : off + n;
+        // the server answers everything sent, then closes
+        if (off == req.size())
+            ::shutdown(fd, SHUT_WR);
+    }
+    ::close(fd);
+};
+
+std::string default_socket() {
+    auto dir = std::getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir)
+        return std::string{dir} + "/spclock.sock";
+    return "/tmp/spclock-" + std::to_string(::getuid()) + ".sock";
+};
+
+} // namespace spclock
@@ -0,0 +1,121 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace spclock {
+
+// a reply that may only go out once ready() says so, like one that
+// acknowledges a change before it is on disk. ready() may rewrite the text
+// before it goes
+struct held_reply {
+    std::function<bool(std::string&)> ready;
+    std::string text;
+};
+
+// what the batches of a script a client sends came to so far
+struct script_totals {
+    size_t batches = 0;
+    size_t lines = 0;
+    size_t set = 0;
+    size_t failed = 0;
+    std::chrono::steady_clock::time_point started;
+};
+
+// what a text connection has to send. held replies go out in order, and
+// whatever a handler appends to out while some are held goes after them.
+// a connection with a feed streams:
+// it stays open after the client is done sending, and the feed gets to
+// append more output when the server is poked and has room for it.
+// the feed returning false ends the stream
+struct session {
+    std::string out;
+    std::deque<held_reply> held;
+    std::function<bool(std::string&)> feed;
+    // left to the line handler, they start out empty
+    std::string scope;
+    std::string batch;        // script lines collected
+    size_t batch_left = 0;    // lines of it still to come
+    size_t batch_skipped = 0; // lines of the script in front of it
+    std::shared_ptr<script_totals> script;
+};
+
+// runs a command line and appends what it prints to the session. returning
+// false closes the connection once that is sent
+using line_handler = std::function<bool(const std::string&, session&)>;
+// runs whole frames of the binary protocol, all that came in one read,
+// and appends the replies to the session or holds them
+using frame_handler = std::function<void(const char*, size_t, session&)>;
+
+// serves text commands on a unix socket from a single thread. the
+// listening socket and every connection are non blocking and polled
+// together, a command runs as soon as its line is complete. a client
+// that shuts down its side gets the rest of its output, then is closed.
+// a connection opening with the protocol magic speaks frames instead
+class server {
+public:
+    server(const std::string& path, line_handler,
+           frame_handler = frame_handler{});
+    ~server();
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+
+    // returns once stop() is called
+    void run();
+    // async signal safe
+    void stop();
+    // has run() call the feeds and look at held replies again, from any
+    // thread. async signal safe
+    void poke();
+
+private:
+    struct conn {
+        int fd;
+        std::string in;
+        session s;
+        bool closing;   // nothing more is read, close once out is sent
+        bool sniffed;   // the protocol is known
+        bool binary;
+    };
+
+    void accept_all();
+    void read_from(conn&);
+    void run_lines(conn&);
+    void run_frames(conn&);
+    void write_to(conn&);
+    void feed(conn&);
+    static void behind_held(conn&, size_t held, size_t out);
+    static void release(conn&);
+
+    std::string path_;
+    line_handler handle_;
+    frame_handler frames_;
+    int listen_fd_;
+    int wake_[2];   // self pipe for stop() and poke()
+    std::vector<conn> conns_;
+};
+
+// a non blocking unix socket listening on path, only for the owner.
+// throws if something answers there already, a stale file is replaced
+int listen_socket(const std::string& path);
+// returns -1 if nothing listens on path
+int connect_socket(const std::string& path);
+
+// sends a command line, or several separated by newlines, to the server
+// at path and copies the reply to out. replies are read while the lines
+// still go out. throws if there is no server
+void call_server(const std::string& path, const std::string& line,
+                 std::ostream& out);
+
+// $XDG_RUNTIME_DIR/spclock.sock, or one per user in /tmp
+std::string default_socket();
+
+} // namespace spclock
+
+#endif
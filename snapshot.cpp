@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+namespace spclock {
+
+namespace {
+// the last byte is the version, 1 had no tags, 1 and 2 had every message
+// ever interned with handles counting up from one
+constexpr char magic[8] = {'S', 'P', 'C', 'S', 'N', 'A', 'P', '3'};
+constexpr size_t buffer_size = 64 * 1024;
+
+// FNV-1a over everything in front of the trailing checksum
+struct checksum {
+    uint64_t h = 14695981039346656037ull;
+
+    void add(const char* data, size_t size) {
+        for (size_t i = 0; i != size; ++i) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 1099511628211ull;
+        }
+    }
+};
+
+uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// buffered writes to a file descriptor. errors stick until the end
+class writer {
+    int fd_;
+    size_t n_;
+    size_t total_;
+    bool ok_;
+    checksum sum_;
+    char buf_[buffer_size];
+
+public:
+    explicit writer(int fd) : fd_{fd}, n_{0}, total_{0}, ok_{true} { }
+
+    void put(const char* data, size_t size) {
+        sum_.add(data, size);
+        while (size) {
+            if (n_ == buffer_size)
+                flush();
+            auto n = std::min(size, buffer_size - n_);
+            std::memcpy(buf_ + n_, data, n);
+            n_ += n;
+            data += n;
+            size -= n;
+        }
+    }
+
+    void byte(uint8_t b) { put(reinterpret_cast<const char*>(&b), 1); }
+
+    void varint(uint64_t v) {
+        char tmp[10];
+        size_t n = 0;
+        for (; v >= 0x80; v >>= 7)
+            tmp[n++] = static_cast<char>(v | 0x80);
+        tmp[n++] = static_cast<char>(v);
+        put(tmp, n);
+    }
+
+    void text(const char* data, size_t size) {
+        varint(size);
+        put(data, size);
+    }
+
+    void flush() {
+        for (size_t off = 0; ok_ && off != n_; ) {
+            auto r = ::write(fd_, buf_ + off, n_ - off);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                ok_ = false;
+            else
+                off += r;
+        }
+        total_ += n_;
+        n_ = 0;
+    }
+
+    // appends the checksum, which is not part of itself
+    size_t finish() {
+        auto h = sum_.h;
+        put(reinterpret_cast<const char*>(&h), sizeof(h));
+        flush();
+        return ok_ ? total_ : 0;
+    }
+};
+
+// bounds checked decoding of a mapped snapshot
+class reader {
+    const char* p_;
+    const char* end_;
+    const std::string& path_;
+
+public:
+    reader(const char* p, const char* end, const std::string& path)
+          : p_{p}, end_{end}, path_(path) { }
+
+    [[noreturn]] void damaged() const {
+        throw std::runtime_error("Snapshot is damaged: " + path_);
+    }
+
+    uint8_t byte() {
+        if (p_ == end_)
+            damaged();
+        return static_cast<uint8_t>(*p_++);
+    }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            auto b = byte();
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        damaged();
+    }
+
+    const char* bytes(size_t size) {
+        if (static_cast<size_t>(end_ - p_) < size)
+            damaged();
+        auto ret = p_;
+        p_ += size;
+        return ret;
+    }
+};
+
+// unmaps and closes on the way out
+struct mapping {
+    int fd = -1;
+    void* base = MAP_FAILED;
+    size_t size = 0;
+
+    ~mapping() {
+        if (base != MAP_FAILED)
+            munmap(base, size);
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+}
+
+size_t write_snapshot(int fd, const buzzer_table& table,
+                      const std::vector<const date::time_zone*>& zones) {
+    writer w{fd};
+    w.put(magic, sizeof(magic));
+    w.varint(table.size());
+
+    w.varint(zones.size());
+    for (auto z:zones) {
+        auto& name = z->name();
+        w.text(name.data(), name.size());
+    }
+    // the empty message is handle zero and is not stored, neither are the
+    // holes of texts gone. a gap of zero ends the messages
+    auto& pool = table.messages();
+    w.varint(pool.count());
+    message_pool::handle prev = 0;
+    for (message_pool::handle h = 1; h < pool.count(); ++h) {
+        auto m = pool.get(h);
+        if (m.size == 0)
+            continue;
+        w.varint(h - prev);
+        w.text(m.data, m.size);
+        prev = h;
+    }
+    w.varint(0);
+
+    size_t next = 0;
+    int64_t last = 0;
+    for (size_t id = 0; id != table.size(); ++id) {
+        auto state = table.state(id);
+        if (state != b_state::running && state != b_state::ringing)
+            continue;
+        auto& meta = table.meta(id);
+        size_t zone = 0;
+        while (zone != zones.size() && zones[zone] != meta.zone)
+            ++zone;
+        // a gap of zero ends the rows
+        w.varint(id + 1 - next);
+        w.varint(zigzag(table.deadline(id) - last));
+        w.byte(static_cast<uint8_t>(state));
+        w.byte(static_cast<uint8_t>(meta.buzzer_type) |
+               static_cast<uint8_t>(meta.priority) << 4);
+        w.varint(meta.message);
+        w.varint(zone == zones.size() ? no_zone : zone);
+        w.varint(meta.tag);
+        next = id + 1;
+        last = table.deadline(id);
+    }
+    w.varint(0);
+    return w.finish();
+};
+
+bool read_snapshot(const std::string& path, snapshot_sink& sink) {
+    mapping m;
+    m.fd = ::open(path.c_str(), O_RDONLY);
+    if (m.fd < 0) {
+        if (errno == ENOENT)
+            return false;
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot open snapshot " + path);
+    }
+    struct stat st;
+    if (fstat(m.fd, &st) < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot stat snapshot " + path);
+    m.size = st.st_size;
+    if (m.size < sizeof(magic) + sizeof(uint64_t))
+        throw std::runtime_error("Snapshot is damaged: " + path);
+    m.base = mmap(nullptr, m.size, PROT_READ, MAP_PRIVATE, m.fd, 0);
+    if (m.base == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot map snapshot " + path);
+    madvise(m.base, m.size, MADV_SEQUENTIAL);
+
+    auto begin = static_cast<const char*>(m.base);
+    auto end = begin + m.size - sizeof(uint64_t);
+    checksum sum;
+    sum.add(begin, end - begin);
+    uint64_t stored;
+    std::memcpy(&stored, end, sizeof(stored));
+    auto version = begin[sizeof(magic) - 1];
+    if (std::memcmp(begin, magic, sizeof(magic) - 1) != 0 ||
+        version < '1' || version > magic[sizeof(magic) - 1] || stored != sum.h)
+        throw std::runtime_error("Snapshot is damaged: " + path);
+
+    reader r{begin + sizeof(magic), end, path};
+    sink.ids(r.varint());
+    for (auto n = r.varint(); n; --n) {
+        auto size = r.varint();
+        auto data = r.bytes(size);
+        sink.zone(std::string(data, size));
+    }
+    if (version >= '3') {
+        sink.handles(r.varint());
+        uint64_t h = 0;
+        while (auto gap = r.varint()) {
+            h += gap;
+            if (h >= UINT32_MAX)
+                r.damaged();
+            auto size = r.varint();
+            sink.message(static_cast<message_pool::handle>(h), r.bytes(size), size);
+        }
+    } else {
+        auto n = r.varint();
+        sink.handles(n + 1);
+        for (message_pool::handle h = 1; h <= n; ++h) {
+            auto size = r.varint();
+            sink.message(h, r.bytes(size), size);
+        }
+    }
+
+    size_t next = 0;
+    int64_t last = 0;
+    while (auto gap = r.varint()) {
+        snapshot_row row;
+        row.id = next + gap - 1;
+        row.deadline = last + unzigzag(r.varint());
+        row.state = static_cast<b_state>(r.byte());
+        auto bits = r.byte();
+        row.buzzer_type = static_cast<b_type>(bits & 0x0f);
+        row.priority = static_cast<b_priority>(bits >> 4);
+        row.message = static_cast<message_pool::handle>(r.varint());
+        row.zone = static_cast<uint16_t>(r.varint());
+        row.tag = (version >= '2') ? static_cast<message_pool::handle>(r.varint())
+                                   : message_pool::empty;
+        if (row.state != b_state::running && row.state != b_state::ringing)
+            r.damaged();
+        sink.row(row);
+        next = row.id + 1;
+        last = row.deadline;
+    }
+    return true;
+};
+
+} // namespace spclock
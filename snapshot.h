@@ -0,0 +1,52 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "table.h"
+
+namespace spclock {
+
+// a running or ringing buzzer as stored in a snapshot
+struct snapshot_row {
+    size_t id;
+    int64_t deadline;
+    b_state state;
+    b_type buzzer_type;
+    b_priority priority;
+    message_pool::handle message;
+    uint16_t zone;  // index into the zones, no_zone if it has none
+    message_pool::handle tag;
+};
+
+constexpr uint16_t no_zone = UINT16_MAX;
+
+// gets a snapshot handed over piece by piece, in file order
+class snapshot_sink {
+public:
+    virtual ~snapshot_sink() = default;
+    virtual void ids(size_t) = 0;       // IDs handed out so far
+    virtual void zone(const std::string&) = 0;
+    virtual void handles(size_t) = 0;   // message handles handed out so far
+    virtual void message(message_pool::handle, const char*, size_t) = 0;
+    virtual void row(const snapshot_row&) = 0;
+};
+
+// writes the running and ringing buzzers of the table to fd, with the
+// messages still in the pool, which are the ones they hold. messages and
+// zones keep their handles and indexes, so records appended to a journal
+// after the snapshot still refer to the right ones. rows go in ID order
+// with IDs and deadlines delta encoded as varints, IDs of buzzers gone
+// take no room.
+// does not allocate. returns the bytes written, zero on error
+size_t write_snapshot(int fd, const buzzer_table&,
+                      const std::vector<const date::time_zone*>&);
+
+// maps the file and decodes it front to back. returns false if there is
+// no such file, throws if it is damaged
+bool read_snapshot(const std::string&, snapshot_sink&);
+
+} // namespace spclock
+
+#endif
@@ -1,27 +1,35 @@
+#include <charconv>
+#include <cstdint>
 #include <iostream>
 #include "spclock.h"
+#include "clock.h"
 #include "parse.h"
 
 namespace spclock {
 
 local_time::local_time() {
-    using std::chrono::system_clock;
     zoned_tp_ = date::make_zoned(
-             date::current_zone(), date::floor<seconds>(system_clock::now()));
+             date::current_zone(), date::floor<seconds>(current_clock().now()));
 };
 
 local_time::local_time(const std::chrono::seconds& sec) {
-    using std::chrono::system_clock;
     auto zone = date::current_zone();
-    auto ltp = date::make_zoned(zone, system_clock::now());
+    auto ltp = date::make_zoned(zone, current_clock().now());
     auto lday = date::floor<date::days>(ltp.get_local_time());
     zoned_tp_ = make_zoned(zone, lday + sec);
 };
 
+local_time::local_time(const date::time_zone* zone, date::sys_seconds tp)
+      :zoned_tp_{zone, tp} { }
+
 const date::time_zone* local_time::zone() const {
     return zoned_tp_.get_time_zone();
 };
 
+date::sys_seconds local_time::sys_time() const {
+    return zoned_tp_.get_sys_time();
+};
+
 std::string local_time::format(const std::string& fmt) const {
     return date::format(fmt, zoned_tp_);
 };
@@ -55,7 +63,17 @@ local_time now() {
     return local_time();
 };
 
-buzzer::buzzer(seconds sec, const std::string& type, std::string message) {
+b_priority parse_priority(std::string_view str) {
+    if (str == "critical")
+        return b_priority::critical;
+    if (str == "normal")
+        return b_priority::normal;
+    if (str == "bulk")
+        return b_priority::bulk;
+    throw std::invalid_argument("Unknown priority: " + std::string{str});
+};
+
+buzzer::buzzer(seconds sec, std::string_view type, std::string message) {
     if (type == "alarm") {
         this->buzzer_type = b_type::alarm;
         this->end_time = local_time(sec);
@@ -63,28 +81,58 @@ buzzer::buzzer(seconds sec, const std::string& type, std::string message) {
         this->buzzer_type = b_type::timer;
         this->end_time = now() + sec;
     }
-    this->message = message;
+    this->message = std::move(message);
     state = b_state::running;
 };
 
-buzzer::buzzer(buzzer&& other)
-      :end_time{other.end_time}, message{std::move(other.message)},
-       buzzer_type{std::move(other.buzzer_type)}, state{std::move(other.state)},
-       stop{std::move(other.stop)} { }
-
-void make_sound() {
-    std::cout << '\7' << std::flush;
+buzzer::buzzer(const date::time_zone* zone, date::sys_seconds now,
+               seconds sec, b_type type, std::string message)
+      :end_time{zone, now + sec}, message{std::move(message)},
+       buzzer_type{type}, state{b_state::running} {
+    if (type == b_type::alarm) {
+        auto lday = date::floor<date::days>(
+                        date::make_zoned(zone, now).get_local_time());
+        end_time = local_time{zone, date::make_zoned(zone, lday + sec).get_sys_time()};
+    }
 };
 
-} //namespace spclock
+namespace {
+char* put(char* p, const char* text) {
+    while (*text)
+        *p++ = *text++;
+    return p;
+}
 
-// output duration in a verbose format
-std::ostream& operator<<(std::ostream& os, const std::chrono::seconds& dur) {
-    auto t = date::make_time(dur);
-    std::ostringstream oss;
-    std::string sign = (dur < std::chrono::seconds{0}) ? "- ": "";
-    oss << sign << t.hours().count() << " hours " << t.minutes().count() 
-                       << " minutes " << t.seconds().count() << " seconds";
-    return os << oss.str();
+char* put_two(char* p, uint64_t n) {
+    *p++ = static_cast<char>('0' + n / 10);
+    *p++ = static_cast<char>('0' + n % 10);
+    return p;
+}
+}
+
+char* format_duration(char* buf, seconds dur, duration_style style) {
+    auto end = buf + max_duration_chars;
+    // the magnitude as unsigned, so the most negative one has one as well
+    auto count = dur.count();
+    uint64_t mag = (count < 0) ? 0 - static_cast<uint64_t>(count) : count;
+    auto p = buf;
+    if (style == duration_style::compact) {
+        if (count < 0)
+            *p++ = '-';
+        p = std::to_chars(p, end, mag / 3600).ptr;
+        *p++ = ':';
+        p = put_two(p, mag / 60 % 60);
+        *p++ = ':';
+        return put_two(p, mag % 60);
+    }
+    if (count < 0)
+        p = put(p, "- ");
+    p = std::to_chars(p, end, mag / 3600).ptr;
+    p = put(p, " hours ");
+    p = std::to_chars(p, end, mag / 60 % 60).ptr;
+    p = put(p, " minutes ");
+    p = std::to_chars(p, end, mag % 60).ptr;
+    return put(p, " seconds");
 };
 
+} //namespace spclock
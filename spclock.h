@@ -2,7 +2,7 @@
 #define SPTIME_H
 
 #include <iostream>
-#include <future>
+#include <string_view>
 #include "date/tz.h"
 
 namespace spclock {
@@ -15,8 +15,10 @@ public:
     local_time(); // construct current time
     // constructing an arbitrary time of the current day
     local_time(const seconds&);
+    local_time(const date::time_zone*, date::sys_seconds);
 
     const date::time_zone* zone() const;
+    date::sys_seconds sys_time() const;
 
     std::string format(const std::string&) const;
 
@@ -36,10 +38,21 @@ enum class b_type {
     timer
 };
 
-enum class b_state {
+// buzzers of a higher class go off first when many are due together
+enum class b_priority {
+    critical,
+    normal,
+    bulk
+};
+
+b_priority parse_priority(std::string_view);
+
+enum class b_state : uint8_t {
     running,
+    ringing,
     finished,
-    cancelled
+    cancelled,
+    missed    // went off while suspended and was dropped by the late policy
 };
 
 struct buzzer {
@@ -47,18 +60,27 @@ struct buzzer {
     std::string message;
     b_type buzzer_type;
     b_state state;
-    std::promise<void> stop;
+    b_priority priority = b_priority::normal;
+    std::string tag;  // for picking buzzers out of event streams
 
-    explicit buzzer(seconds,const std::string&, std::string);
-    buzzer(const buzzer&) = delete; //no copy - it has promise
-    buzzer(buzzer&&);
+    explicit buzzer(seconds, std::string_view, std::string);
+    // for adding many at once, the zone and the time are looked up once
+    buzzer(const date::time_zone*, date::sys_seconds, seconds, b_type,
+           std::string);
 };
 
-void make_sound();
+enum class duration_style {
+    compact,    // -1:02:03, which parse_time reads back
+    verbose     // - 1 hours 2 minutes 3 seconds
+};
 
-} // namespace spclock
+// enough for any duration in either style
+constexpr size_t max_duration_chars = 48;
+
+// writes the duration to buf, which has room for max_duration_chars, and
+// returns the end of what it wrote. nothing is allocated
+char* format_duration(char* buf, seconds, duration_style = duration_style::verbose);
 
-// outputs duration in a very verbose way
-std::ostream& operator<<(std::ostream&, const std::chrono::seconds&);
+} // namespace spclock
 
 #endif
@@ -0,0 +1,143 @@
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "status.h"
+
+namespace spclock {
+
+namespace {
+constexpr uint64_t magic = 0x5350435354415432ull;  // "SPCSTAT2"
+}
+
+struct status_page::layout {
+    uint64_t magic;
+    int64_t writer;     // process ID
+    // odd while a publish is halfway through
+    std::atomic<uint64_t> seq;
+    status_data data;
+};
+
+// whether the process that wrote the page is still there
+bool status_page::writer_alive(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(layout))
+        p = mmap(nullptr, sizeof(layout), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    auto page = static_cast<const layout*>(p);
+    auto pid = static_cast<pid_t>(page->writer);
+    bool alive = page->magic == magic && pid > 0 &&
+                 (::kill(pid, 0) == 0 || errno == EPERM);
+    munmap(p, sizeof(layout));
+    return alive;
+};
+
+status_page::status_page(const std::string& name, bool writer)
+      :name_{name}, page_{nullptr}, writer_{writer} {
+    int fd = -1;
+    if (writer) {
+        // one left behind by a clock that is gone is taken over
+        for (int tries = 0; tries != 3; ++tries) {
+            fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd >= 0 || errno != EEXIST)
+                break;
+            if (writer_alive(name))
+                throw std::runtime_error("Status page " + name +
+                                         " is published by another clock");
+            shm_unlink(name.c_str());
+        }
+    } else {
+        fd = shm_open(name.c_str(), O_RDONLY, 0);
+    }
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot open status page " + name);
+    if (writer && ftruncate(fd, sizeof(layout)) < 0) {
+        auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(),
+                                "Cannot size status page " + name);
+    }
+    auto prot = writer ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* p = mmap(nullptr, sizeof(layout), prot, MAP_SHARED, fd, 0);
+    auto err = errno;
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::system_error(err, std::generic_category(),
+                                "Cannot map status page " + name);
+    page_ = static_cast<layout*>(p);
+    if (writer) {
+        page_->writer = ::getpid();
+        page_->seq.store(0, std::memory_order_relaxed);
+        std::memset(&page_->data, 0, sizeof(page_->data));
+        page_->magic = magic;
+    } else if (page_->magic != magic) {
+        munmap(page_, sizeof(layout));
+        throw std::runtime_error("Not a status page: " + name);
+    }
+};
+
+// a page some other clock took over stays
+status_page::~status_page() {
+    bool own = writer_ && page_->writer == ::getpid();
+    munmap(page_, sizeof(layout));
+    if (own)
+        shm_unlink(name_.c_str());
+}
+
+void status_page::publish(const status_data& d) {
+    auto s = page_->seq.load(std::memory_order_relaxed);
+    page_->seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&page_->data, &d, sizeof(d));
+    page_->seq.store(s + 2, std::memory_order_release);
+};
+
+constexpr std::chrono::milliseconds status_page::read_patience;
+
+bool status_page::read(status_data& d) const {
+    // the clock is only looked at once the first tries failed
+    std::chrono::steady_clock::time_point give_up{};
+    for (unsigned tries = 0; ; ++tries) {
+        auto s = page_->seq.load(std::memory_order_acquire);
+        if (!(s & 1)) {
+            std::memcpy(&d, &page_->data, sizeof(d));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (page_->seq.load(std::memory_order_relaxed) == s)
+                return true;
+        }
+        if (tries == 64)
+            give_up = std::chrono::steady_clock::now() + read_patience;
+        else if (tries > 64 && std::chrono::steady_clock::now() >= give_up)
+            return false;
+        std::this_thread::yield();
+    }
+};
+
+std::string default_status_name(const std::string& socket_path) {
+    // FNV-1a, shared memory names have no room for a path
+    uint64_t h = 14695981039346656037ull;
+    for (auto c:socket_path) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+    return "/spclock-" + std::to_string(::getuid()) + "-" + hex;
+};
+
+} // namespace spclock
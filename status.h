@@ -0,0 +1,65 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace spclock {
+
+constexpr size_t status_slots = 16;
+
+// what the scheduler publishes. plain data, readers copy it out whole
+struct status_data {
+    int64_t updated;     // seconds since epoch
+    uint64_t pending;
+    uint64_t ringing;
+    uint64_t fired;
+    uint64_t admitted;
+    uint64_t rejected;
+    uint32_t next_count;
+    uint32_t ringing_count;
+    int64_t next_deadline[status_slots];  // earliest running buzzers
+    uint64_t next_id[status_slots];
+    uint64_t ringing_id[status_slots];
+};
+
+// the latest status_data in shared memory under a seqlock. there is one
+// writer, readers map the page once and then read it without a syscall
+// or any lock the writer could wait on
+class status_page {
+public:
+    // a publish takes microseconds, one taking longer than this is not
+    // going to finish
+    static constexpr std::chrono::milliseconds read_patience{50};
+
+    // the writer creates the shared memory object and removes it again,
+    // taking over one whose writer is gone. it throws if a running one
+    // has it, a reader throws if there is none
+    status_page(const std::string& name, bool writer);
+    ~status_page();
+    status_page(const status_page&) = delete;
+    status_page& operator=(const status_page&) = delete;
+
+    void publish(const status_data&);
+    // retries until it gets a copy no publish ran through. false if a
+    // publish was halfway through for all of read_patience, as it stays
+    // when the writer dies in the middle of one
+    bool read(status_data&) const;
+
+private:
+    struct layout;
+    static bool writer_alive(const std::string& name);
+
+    std::string name_;
+    layout* page_;
+    bool writer_;
+};
+
+// per user and daemon socket, so neither sessions of different users nor
+// two daemons of one user mix
+std::string default_status_name(const std::string& socket_path);
+
+} // namespace spclock
+
+#endif
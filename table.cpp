@@ -0,0 +1,114 @@
+#include <algorithm>
+#include "table.h"
+
+namespace spclock {
+
+namespace {
+// rows compared per block, the masks of a block fit on the stack
+constexpr size_t block = 256;
+}
+
+constexpr size_t buzzer_table::page_bits;
+constexpr size_t buzzer_table::page_size;
+const buzzer_meta buzzer_table::gone_{nullptr, message_pool::empty, b_type::timer,
+                                      b_priority::normal};
+
+buzzer_table::page::page() {
+    std::fill(std::begin(deadline), std::end(deadline), 0);
+    std::fill(std::begin(state), std::end(state), b_state::cancelled);
+    std::fill(std::begin(meta), std::end(meta), gone_);
+};
+
+size_t buzzer_table::push(const buzzer& b) {
+    return push_row(b.end_time.sys_time().time_since_epoch().count(), b.state,
+                    {b.end_time.zone(), messages_.intern(b.message),
+                     b.buzzer_type, b.priority, messages_.intern(b.tag)});
+};
+
+size_t buzzer_table::push_row(int64_t deadline, b_state state,
+                              const buzzer_meta& meta) {
+    auto id = size_;
+    skip(id + 1);
+    auto& p = pages_[id >> page_bits];
+    if (!p)
+        p.reset(new page);
+    p->deadline[slot(id)] = deadline;
+    p->state[slot(id)] = state;
+    p->meta[slot(id)] = meta;
+    return id;
+};
+
+void buzzer_table::skip(size_t n) {
+    if (n <= size_)
+        return;
+    size_ = n;
+    pages_.resize((n + page_size - 1) >> page_bits);
+};
+
+// the last page still gets rows, it stays
+void buzzer_table::trim() {
+    for (size_t p = 0; p + 1 < pages_.size(); ++p) {
+        if (!pages_[p])
+            continue;
+        auto st = pages_[p]->state;
+        bool live = false;
+        for (size_t j = 0; j != page_size; ++j)
+            live |= (st[j] == b_state::running) | (st[j] == b_state::ringing);
+        if (!live)
+            pages_[p].reset();
+    }
+};
+
+buzzer_view buzzer_table::view(size_t id) const {
+    return {id, date::sys_seconds{seconds{deadline(id)}}, state(id), meta(id),
+            message(id)};
+};
+
+size_t buzzer_table::count(b_state s) const {
+    size_t n = 0;
+    for (size_t p = 0; p != pages_.size(); ++p) {
+        if (!pages_[p])
+            continue;
+        auto st = pages_[p]->state;
+        auto rows = std::min(page_size, size_ - (p << page_bits));
+        for (size_t j = 0; j != rows; ++j)
+            n += (st[j] == s);
+    }
+    return n;
+};
+
+// the compares run branch free over a block to build a mask, only the
+// few matching rows are then picked out one by one
+void buzzer_table::select_active(int64_t lo, int64_t hi,
+                                 std::vector<size_t>& out) const {
+    auto running = static_cast<uint8_t>(b_state::running);
+    auto ringing = static_cast<uint8_t>(b_state::ringing);
+    uint8_t mask[block];
+
+    for (size_t p = 0; p != pages_.size(); ++p) {
+        if (!pages_[p])
+            continue;
+        auto dl = pages_[p]->deadline;
+        auto st = reinterpret_cast<const uint8_t*>(pages_[p]->state);
+        auto first = p << page_bits;
+        auto rows = std::min(page_size, size_ - first);
+        for (size_t base = 0; base < rows; base += block) {
+            auto n = std::min(block, rows - base);
+            uint8_t any = 0;
+            for (size_t j = 0; j != n; ++j) {
+                auto s = st[base + j];
+                auto d = dl[base + j];
+                mask[j] = ((s == running) | (s == ringing)) & (d >= lo) & (d < hi);
+                any |= mask[j];
+            }
+            if (!any)
+                continue;
+            for (size_t j = 0; j != n; ++j) {
+                if (mask[j])
+                    out.push_back(first + base + j);
+            }
+        }
+    }
+};
+
+} // namespace spclock
@@ -0,0 +1,122 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "spclock.h"
+#include "messages.h"
+
+namespace spclock {
+
+// fields only touched when a buzzer is shown or fires
+struct buzzer_meta {
+    const date::time_zone* zone;
+    message_pool::handle message;
+    b_type buzzer_type;
+    b_priority priority;
+    message_pool::handle tag = message_pool::empty;
+};
+
+// a row of the table as handed out to visitors
+struct buzzer_view {
+    size_t id;
+    date::sys_seconds deadline;
+    b_state state;
+    const buzzer_meta& meta;
+    msg_ref message;
+
+    local_time end_time() const { return local_time{meta.zone, deadline}; }
+};
+
+// buzzers by ID in structure of arrays layout. deadlines and states are
+// dense arrays so scans over them stay in cache and vectorize, the rest
+// lives in a separate cold array with messages interned in a pool.
+// rows come in pages of page_size IDs. a page only exists once a row of it
+// was pushed and goes again once nothing in it runs or rings, IDs without
+// a page read as cancelled rows
+class buzzer_table {
+public:
+    static constexpr size_t page_bits = 12;
+    static constexpr size_t page_size = size_t{1} << page_bits;
+
+private:
+    struct page {
+        int64_t deadline[page_size];  // seconds since epoch
+        b_state state[page_size];
+        buzzer_meta meta[page_size];
+
+        page();
+    };
+
+    const page* find(size_t id) const {
+        auto p = id >> page_bits;
+        return p < pages_.size() ? pages_[p].get() : nullptr;
+    }
+    page* find(size_t id) {
+        auto p = id >> page_bits;
+        return p < pages_.size() ? pages_[p].get() : nullptr;
+    }
+    static size_t slot(size_t id) { return id & (page_size - 1); }
+
+    std::vector<std::unique_ptr<page>> pages_;
+    size_t size_ = 0;
+    message_pool messages_;
+    static const buzzer_meta gone_;
+
+public:
+    size_t push(const buzzer&);
+    size_t push_row(int64_t, b_state, const buzzer_meta&);
+    // IDs handed out so far, with or without a row
+    size_t size() const { return size_; }
+    // hands out the IDs up to n without rows for them
+    void skip(size_t n);
+    // whether the ID has a row, even a cancelled one
+    bool has(size_t id) const { return id < size_ && find(id); }
+    // drops the pages nothing runs or rings in any more
+    void trim();
+
+    int64_t deadline(size_t id) const {
+        auto p = find(id);
+        return p ? p->deadline[slot(id)] : 0;
+    }
+    b_state state(size_t id) const {
+        auto p = find(id);
+        return p ? p->state[slot(id)] : b_state::cancelled;
+    }
+    // setters only reach rows there are
+    void set_state(size_t id, b_state s) {
+        if (auto p = find(id))
+            p->state[slot(id)] = s;
+    }
+    void set_deadline(size_t id, int64_t d) {
+        if (auto p = find(id))
+            p->deadline[slot(id)] = d;
+    }
+    const buzzer_meta& meta(size_t id) const {
+        auto p = find(id);
+        return p ? p->meta[slot(id)] : gone_;
+    }
+    msg_ref message(size_t id) const { return messages_.get(meta(id).message); }
+    msg_ref tag(size_t id) const { return messages_.get(meta(id).tag); }
+    void set_tag(size_t id, message_pool::handle h) {
+        if (auto p = find(id))
+            p->meta[slot(id)].tag = h;
+    }
+    // once the buzzer let go of its texts
+    void forget_texts(size_t id) {
+        if (auto p = find(id))
+            p->meta[slot(id)].message = p->meta[slot(id)].tag = message_pool::empty;
+    }
+    const message_pool& messages() const { return messages_; }
+    message_pool& messages() { return messages_; }
+    buzzer_view view(size_t) const;
+
+    size_t count(b_state) const;
+    // IDs of running or ringing buzzers with a deadline in [lo, hi)
+    void select_active(int64_t lo, int64_t hi, std::vector<size_t>&) const;
+};
+
+} // namespace spclock
+
+#endif
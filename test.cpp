@@ -0,0 +1,621 @@
+// behaviour tests of the scheduler on a virtual clock: late firing,
+// priority deferral, admission limits, the journal, snapshots, hot standby
+// and the event log. prints every failed check and exits with 1 if any did.
+// usage: clock-test
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "spclock.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "journal.h"
+#include "eventlog.h"
+#include "replica.h"
+
+namespace {
+using spclock::seconds;
+using spclock::b_state;
+using spclock::b_priority;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (ok)
+        return;
+    ++failures;
+    std::cout << "  failed: " << what << std::endl;
+}
+
+const date::sys_seconds start = date::sys_days{date::year{2024} / 1 / 1};
+
+// every test gets a clock of its own, made before its schedulers
+struct sim {
+    spclock::virtual_clock vc{start};
+
+    sim() { spclock::set_clock(&vc); }
+    ~sim() { spclock::set_clock(nullptr); }
+    void run(spclock::scheduler& s, int64_t to) { s.simulate(vc, start + seconds{to}); }
+};
+
+// a directory for the files of one test, removed again after it
+struct scratch {
+    std::string dir;
+
+    scratch() {
+        char tmpl[] = "/tmp/spclock-test.XXXXXX";
+        if (!::mkdtemp(tmpl))
+            throw std::runtime_error("Cannot create a scratch directory");
+        dir = tmpl;
+    }
+    ~scratch() {
+        auto r = std::system(("rm -rf " + dir).c_str());
+        (void)r;
+    }
+    std::string path(const std::string& name) const { return dir + "/" + name; }
+};
+
+spclock::buzzer timer(int64_t in, const std::string& message,
+                      b_priority prio = b_priority::normal,
+                      const std::string& tag = std::string{}) {
+    auto now = date::floor<seconds>(spclock::current_clock().now());
+    spclock::buzzer b{date::locate_zone("UTC"), now, seconds{in},
+                      spclock::b_type::timer, message};
+    b.priority = prio;
+    b.tag = tag;
+    return b;
+}
+
+struct row {
+    int64_t deadline;
+    b_state state;
+    std::string message;
+    b_priority priority;
+
+    bool operator==(const row& o) const {
+        return deadline == o.deadline && state == o.state &&
+               message == o.message && priority == o.priority;
+    }
+};
+
+// what is running or ringing, by ID
+std::map<size_t, row> rows(const spclock::scheduler& s) {
+    std::map<size_t, row> ret;
+    s.visit_active([&](const spclock::buzzer_view& v) {
+        ret.emplace(v.id, row{v.deadline.time_since_epoch().count(), v.state,
+                              v.message.str(), v.meta.priority});
+    });
+    return ret;
+}
+
+// the tag of every running buzzer, read off the cancels of stopping all
+std::map<size_t, std::string> stop_all_tags(spclock::scheduler& s) {
+    std::map<size_t, std::string> ret;
+    s.observe([&](const spclock::sched_event& ev) {
+        if (ev.kind == spclock::event_kind::cancel)
+            ret[ev.id] = std::string(ev.tag.data, ev.tag.size);
+    });
+    s.stop_all();
+    s.observe(nullptr);
+    return ret;
+}
+
+// for what other threads do, gives up after a few seconds
+bool wait_for(const std::function<bool()>& done) {
+    for (int i = 0; i != 500; ++i) {
+        if (done())
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    return false;
+}
+
+// buzzers overdue after a resume come as one batch, what rings in it
+// depends on the late policy
+void late_fire_batching() {
+    using spclock::late_policy;
+    for (auto policy:{late_policy::fire_all, late_policy::latest_only,
+                      late_policy::drop_stale}) {
+        sim sm;
+        spclock::sched_options opts;
+        opts.late = policy;
+        std::vector<spclock::fire_batch> fired;
+        spclock::scheduler s{[&](spclock::fire_batch b) { fired.push_back(b); }, opts};
+        auto a = s.add(timer(10, "a"));
+        auto b = s.add(timer(30, "b"));
+        auto c = s.add(timer(20, "c"));
+
+        sm.vc.suspend(seconds{100});
+        sm.vc.advance_to(start + seconds{100});
+        sm.run(s, 100);
+        check(fired.size() == 1, "one batch for everything overdue");
+        if (fired.size() != 1)
+            continue;
+        check(fired[0].overdue == 3, "three overdue");
+        check(fired[0].suspended == seconds{100}, "suspended time reported");
+        auto states = rows(s);
+        if (policy == late_policy::fire_all) {
+            check(fired[0].ids == std::vector<size_t>{a, c, b}, "fire_all rings all in order");
+            check(states.size() == 3, "fire_all leaves all ringing");
+        } else if (policy == late_policy::latest_only) {
+            check(fired[0].ids == std::vector<size_t>{b}, "latest_only rings the latest");
+            check(states.size() == 1 && states.count(b), "latest_only leaves one ringing");
+            check(s.stop(a) == b_state::missed, "latest_only misses the others");
+        } else {
+            check(fired[0].ids.empty(), "drop_stale rings nothing");
+            check(states.empty(), "drop_stale leaves nothing");
+            check(s.stop(b) == b_state::missed, "drop_stale misses all");
+        }
+
+        // without a suspend it is on time again
+        fired.clear();
+        auto d = s.add(timer(10, "d"));
+        sm.run(s, 110);
+        check(fired.size() == 1 && fired[0].overdue == 0 &&
+              fired[0].ids == std::vector<size_t>{d}, "on time after the resume");
+    }
+}
+
+// critical buzzers go first, due bulk ones over max_batch wait for their
+// slack or for the next pass something else causes
+void priority_deferral() {
+    sim sm;
+    spclock::sched_options opts;
+    opts.max_batch = 2;
+    opts.bulk_slack = seconds{60};
+    std::vector<std::pair<int64_t, spclock::fire_batch>> fired;
+    spclock::scheduler s{[&](spclock::fire_batch b) {
+        auto now = date::floor<seconds>(sm.vc.now()) - start;
+        fired.emplace_back(now.count(), b);
+    }, opts};
+    std::vector<size_t> bulk;
+    for (int i = 0; i != 3; ++i)
+        bulk.push_back(s.add(timer(10, "bulk", b_priority::bulk)));
+    auto c1 = s.add(timer(10, "critical", b_priority::critical));
+    auto c2 = s.add(timer(10, "critical", b_priority::critical));
+    auto n = s.add(timer(30, "normal"));
+
+    sm.run(s, 29);
+    check(fired.size() == 2, "only max_batch fire when due");
+    if (fired.size() == 2) {
+        check(fired[0].second.ids == std::vector<size_t>{c1} &&
+              fired[1].second.ids == std::vector<size_t>{c2}, "critical ones first");
+        check(fired[0].second.priority == b_priority::critical, "batch priority");
+    }
+    sm.run(s, 30);
+    check(fired.size() == 4, "a normal one takes a deferred one along");
+    if (fired.size() == 4) {
+        check(fired[2].second.ids == std::vector<size_t>{n}, "the normal one");
+        check(fired[3].second.ids == std::vector<size_t>{bulk[0]} &&
+              fired[3].first == 30, "one bulk one with it");
+    }
+    sm.run(s, 69);
+    check(fired.size() == 4, "the rest waits for the slack");
+    sm.run(s, 70);
+    check(fired.size() == 6, "the rest once the slack ran out");
+    if (fired.size() == 6)
+        check(fired[4].first == 70 && fired[5].first == 70 &&
+              fired[5].second.priority == b_priority::bulk, "bulk at the end of the slack");
+}
+
+void admission_limits() {
+    sim sm;
+    spclock::sched_options opts;
+    opts.max_pending = 2;
+    opts.max_bytes = 16;
+    // block mode has nobody to make room under a virtual clock
+    opts.admit = spclock::admission::block;
+    spclock::scheduler s{[](spclock::fire_batch) {}, opts};
+    auto a = s.add(timer(10, "a"));
+    s.add(timer(10, "b"));
+    bool threw = false;
+    try {
+        s.add(timer(10, "c"));
+    } catch (spclock::admission_error&) {
+        threw = true;
+    }
+    check(threw, "the pending limit rejects");
+    auto st = s.stats();
+    check(st.pending == 2 && st.pending_headroom == 0 && st.rejected == 1, "pending gauges");
+
+    s.stop(a);
+    s.add(timer(10, "c"));
+    check(s.stats().admitted == 3, "room after a stop");
+
+    s.set_limits(10, 16);
+    threw = false;
+    try {
+        s.add(timer(10, "a message over sixteen bytes"));
+    } catch (spclock::admission_error&) {
+        threw = true;
+    }
+    check(threw, "the byte limit rejects");
+    auto res = s.add_batch({timer(10, "d"), timer(10, "fifteen bytes!!"), timer(10, "e")},
+                           spclock::durability::none);
+    check(res.size() == 3 && res[0].error.empty() && !res[1].error.empty() &&
+          res[2].error.empty(), "a batch rejects only what is over");
+    check(s.stats().pending_bytes == 4, "pending bytes");
+
+    spclock::sched_options rated;
+    rated.max_rate = 2;
+    spclock::scheduler r{[](spclock::fire_batch) {}, rated};
+    r.add(timer(10, "x"));
+    r.add(timer(10, "x"));
+    threw = false;
+    try {
+        r.add(timer(10, "x"));
+    } catch (spclock::admission_error&) {
+        threw = true;
+    }
+    check(threw, "the rate limit rejects");
+    sm.vc.advance_to(sm.vc.now() + seconds{1});
+    r.add(timer(10, "x"));
+    r.add(timer(10, "x"));
+    check(r.stats().admitted == 4, "the bucket refills with time");
+}
+
+// a new scheduler attached to the journal ends up where the old one was,
+// ringing buzzers are delivered again
+void journal_replay() {
+    sim sm;
+    scratch dir;
+    auto path = dir.path("journal");
+    std::map<size_t, row> before;
+    {
+        spclock::journal j{path};
+        spclock::scheduler s{[](spclock::fire_batch) {}};
+        s.attach(j);
+        auto a = s.add(timer(100, "gone", b_priority::critical, "t"));
+        auto b = s.add(timer(200, "shared", b_priority::normal, "kept"));
+        s.add(timer(300, "shared", b_priority::bulk));
+        s.stop(a);
+        s.snooze(b, seconds{500});
+        sm.run(s, 300);
+        // the text of a stopped one is freed and the handle used again
+        s.add(timer(400, "reused"));
+        before = rows(s);
+    }
+    check(before.size() == 3, "three left before the restart");
+
+    spclock::journal j{path};
+    std::vector<spclock::fire_batch> fired;
+    spclock::scheduler s{[&](spclock::fire_batch b) { fired.push_back(b); }};
+    check(s.attach(j) > 0, "records replayed");
+    check(rows(s) == before, "the same buzzers after a replay");
+    check(fired.size() == 1 && fired[0].ids == std::vector<size_t>{2},
+          "the ringing one again");
+    check(s.add(timer(10, "next")) == 4, "IDs go on after the replay");
+    check(stop_all_tags(s) == std::map<size_t, std::string>{{1, "kept"}, {3, ""}, {4, ""}},
+          "tags after a replay");
+}
+
+// a record that did not make it to the disk whole ends the replay, the
+// next append goes where it was
+void torn_tail() {
+    sim sm;
+    scratch dir;
+    auto path = dir.path("journal");
+    size_t records;
+    {
+        spclock::journal j{path};
+        spclock::scheduler s{[](spclock::fire_batch) {}};
+        s.attach(j);
+        s.add(timer(100, "kept"));
+        auto b = s.add(timer(200, "torn"));
+        s.stop(b);
+        records = j.records();
+    }
+    // the last record is the stop, after the header of one record size
+    int fd = ::open(path.c_str(), O_RDWR);
+    auto off = static_cast<off_t>(records * sizeof(spclock::journal_record) +
+                                  offsetof(spclock::journal_record, id));
+    char c;
+    check(fd >= 0 && ::pread(fd, &c, 1, off) == 1, "journal readable");
+    c ^= 0x5a;
+    check(::pwrite(fd, &c, 1, off) == 1, "journal writable");
+    ::close(fd);
+
+    {
+        spclock::journal j{path};
+        spclock::scheduler s{[](spclock::fire_batch) {}};
+        check(s.attach(j) == records - 1, "the replay stops at the torn record");
+        auto r = rows(s);
+        check(r.size() == 2 && r.count(1), "the stop is lost");
+        s.add(timer(300, "after"));
+    }
+    spclock::journal j{path};
+    spclock::scheduler s{[](spclock::fire_batch) {}};
+    s.attach(j);
+    auto r = rows(s);
+    check(r.size() == 3 && r.count(2) && r.at(2).message == "after",
+          "appends after a torn tail replay");
+}
+
+// a batch waits for one commit, not one per record
+void group_commit() {
+    sim sm;
+    scratch dir;
+    spclock::journal j{dir.path("journal"), std::chrono::milliseconds{20}};
+    spclock::scheduler s{[](spclock::fire_batch) {}};
+    s.attach(j);
+    std::vector<spclock::buzzer> bs;
+    for (int i = 0; i != 500; ++i)
+        bs.push_back(timer(100 + i, "batched"));
+    auto res = s.add_batch(std::move(bs), spclock::durability::batched);
+    check(res.size() == 500 && res.back().error.empty(), "the batch is admitted");
+    auto st = j.stats();
+    check(st.appended >= 500 && st.synced == st.appended, "synced once it returns");
+    check(st.commits < 10, "a few commits for the batch");
+    check(s.is_durable(s.last_logged(), spclock::durability::batched), "durable");
+
+    s.add(timer(10, "later"), {spclock::admission::reject, spclock::durability::none});
+    auto seq = s.last_logged();
+    check(wait_for([&] { return s.is_durable(seq, spclock::durability::immediate); }),
+          "an unsynced add gets synced");
+}
+
+// a snapshot holds everything the journal did, and empties it
+void snapshot_round_trip() {
+    sim sm;
+    scratch dir;
+    auto path = dir.path("journal");
+    auto snap = dir.path("journal.snap");
+    spclock::sched_options opts;
+    opts.snapshots = spclock::snapshot_mode::foreground;
+    std::map<size_t, row> before;
+    std::map<size_t, std::string> tags;
+    {
+        spclock::journal j{path};
+        spclock::scheduler s{[](spclock::fire_batch) {}, opts};
+        s.attach(j, snap);
+        for (int i = 0; i != 50; ++i) {
+            auto tag = (i % 3) ? "t" + std::to_string(i % 4) : std::string{};
+            auto id = s.add(timer(10 + i, "message " + std::to_string(i % 7),
+                                  static_cast<b_priority>(i % 3), tag));
+            tags[id] = tag;
+        }
+        for (size_t id = 10; id != 50; id += 2) {
+            s.stop(id);
+            tags.erase(id);
+        }
+        sm.run(s, 12);
+        check(s.snapshot() > 0, "a snapshot in the foreground");
+        check(j.records() == 0, "the journal is emptied");
+        tags[s.add(timer(100, "after the snapshot", b_priority::normal, "late"))] = "late";
+        before = rows(s);
+    }
+    for (auto& r:before)
+        if (r.second.state != b_state::running)
+            tags.erase(r.first);
+
+    spclock::journal j{path};
+    std::vector<spclock::fire_batch> fired;
+    spclock::scheduler s{[&](spclock::fire_batch b) { fired.push_back(b); }, opts};
+    check(s.attach(j, snap) > 0, "the journal after the snapshot");
+    check(rows(s) == before, "the same buzzers from the snapshot");
+    check(fired.size() == 1 && fired[0].ids == std::vector<size_t>{0, 1, 2},
+          "the ringing ones again");
+    check(stop_all_tags(s) == tags, "the same tags from the snapshot");
+}
+
+// the child writes the snapshot, changes meanwhile go to a new journal
+void background_snapshot() {
+    sim sm;
+    scratch dir;
+    auto path = dir.path("journal");
+    auto snap = dir.path("journal.snap");
+    std::map<size_t, row> before;
+    {
+        spclock::journal j{path};
+        spclock::scheduler s{[](spclock::fire_batch) {}};
+        s.attach(j, snap);
+        for (int i = 0; i != 20; ++i)
+            s.add(timer(100 + i, "before"));
+        check(s.snapshot() == 0, "a snapshot in the background");
+        for (int i = 0; i != 5; ++i)
+            s.add(timer(200 + i, "meanwhile"));
+        s.stop(3);
+        check(wait_for([&] {
+            auto st = s.stats();
+            return st.snapshots + st.snapshot_failures != 0;
+        }), "the child finishes");
+        check(s.stats().snapshots == 1, "the snapshot is written");
+        check(::access((path + ".old").c_str(), F_OK) != 0, "the old journal goes");
+        before = rows(s);
+    }
+    spclock::journal j{path};
+    spclock::scheduler s{[](spclock::fire_batch) {}};
+    s.attach(j, snap);
+    check(rows(s) == before && before.size() == 24, "the same buzzers after a restart");
+}
+
+// a follower gets a snapshot, then the records. one that lost the leader
+// connects again and starts over from a new snapshot
+void follower_resync() {
+    sim sm;
+    scratch dir;
+    auto socket = dir.path("replica.sock");
+    auto fpath = dir.path("follower");
+    spclock::journal lj{dir.path("leader")};
+    spclock::scheduler leader{[](spclock::fire_batch) {}};
+    leader.attach(lj);
+    for (int i = 0; i != 10; ++i)
+        leader.add(timer(100 + i, "replicated " + std::to_string(i)));
+    std::unique_ptr<spclock::replicator> rep{new spclock::replicator(socket)};
+    rep->add("home", leader, lj);
+
+    std::mutex m;
+    std::unique_ptr<spclock::journal> fj;
+    std::unique_ptr<spclock::scheduler> fs;
+    int starts = 0;
+    auto start_one = [&](const std::string&) -> spclock::scheduler& {
+        std::lock_guard<std::mutex> lck(m);
+        fs.reset();
+        fj.reset();
+        ::unlink(fpath.c_str());
+        fj.reset(new spclock::journal(fpath));
+        fs.reset(new spclock::scheduler([](spclock::fire_batch) {}));
+        fs->standby(true);
+        fs->attach(*fj, fpath + ".snap");
+        ++starts;
+        return *fs;
+    };
+    auto snapshot_of = [&](const std::string&) { return fpath + ".snap"; };
+    size_t followed = 0;
+    std::thread t{[&] {
+        followed = spclock::follow(socket, snapshot_of, start_one,
+                                   std::chrono::milliseconds{300});
+    }};
+    auto same = [&](int n) {
+        std::lock_guard<std::mutex> lck(m);
+        return starts == n && fs && rows(*fs) == rows(leader);
+    };
+
+    check(wait_for([&] { return same(1); }), "the snapshot");
+    leader.stop(2);
+    leader.snooze(3, seconds{50});
+    leader.add(timer(10, "streamed"));
+    check(wait_for([&] { return same(1); }), "the records after it");
+
+    rep.reset();
+    leader.stop(4);
+    leader.add(timer(20, "while away"));
+    rep.reset(new spclock::replicator(socket));
+    rep->add("home", leader, lj);
+    check(wait_for([&] { return same(2); }), "a new snapshot after reconnecting");
+    leader.stop(5);
+    check(wait_for([&] { return same(2); }), "the records after the new one");
+
+    rep.reset();
+    t.join();
+    check(followed == 1, "one namespace followed");
+    auto expect = rows(leader);
+    fs->standby(false);
+    check(rows(*fs) == expect, "taken over as it was");
+    fs.reset();
+    fj.reset();
+    spclock::journal j{fpath};
+    spclock::scheduler s{[](spclock::fire_batch) {}};
+    s.attach(j, fpath + ".snap");
+    check(rows(s) == expect, "the follower's own journal");
+}
+
+// the namespace comes first, then the events in the order they happened
+void event_log_order() {
+    sim sm;
+    scratch dir;
+    auto path = dir.path("events");
+    size_t a, b;
+    {
+        spclock::event_log log{path, spclock::log_format::binary};
+        spclock::scheduler s{[](spclock::fire_batch) {}};
+        s.record_to(&log, log.space("home"));
+        a = s.add(timer(10, "a"));
+        b = s.add(timer(20, "b"));
+        sm.run(s, 10);
+        s.stop(a);
+        s.snooze(b, seconds{100});
+        s.stop(b);
+        s.record_to(nullptr);
+        check(log.dropped() == 0, "nothing dropped");
+    }
+    std::ifstream in{path, std::ios::binary};
+    std::string data{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+    check(data.compare(0, 8, "SPCLOG01") == 0, "the magic");
+    std::vector<spclock::log_record> recs;
+    std::vector<std::string> names;
+    for (size_t off = 8; off + sizeof(spclock::log_record) <= data.size();) {
+        spclock::log_record r;
+        std::memcpy(&r, data.data() + off, sizeof(r));
+        off += sizeof(r);
+        if (r.event == spclock::log_event::named) {
+            names.push_back(data.substr(off, r.deadline));
+            off += (r.deadline + sizeof(r) - 1) / sizeof(r) * sizeof(r);
+        } else {
+            recs.push_back(r);
+        }
+    }
+    check(names == std::vector<std::string>{"home"}, "the namespace is named");
+    using spclock::log_event;
+    std::vector<std::pair<log_event, size_t>> expect{
+        {log_event::added, a}, {log_event::added, b}, {log_event::fired, a},
+        {log_event::acknowledged, a}, {log_event::snoozed, b}, {log_event::cancelled, b}};
+    std::vector<std::pair<log_event, size_t>> got;
+    for (auto& r:recs)
+        got.emplace_back(r.event, r.id);
+    check(got == expect, "the events in order");
+    if (recs.size() == expect.size())
+        check(recs[4].deadline == (start + seconds{110}).time_since_epoch().count(),
+              "a snooze has its new deadline");
+
+    // threads record without waiting for each other, the file is in order
+    auto json = dir.path("events.json");
+    {
+        spclock::event_log log{json, spclock::log_format::json};
+        auto space = log.space("home");
+        std::vector<std::thread> threads;
+        for (int i = 0; i != 4; ++i)
+            threads.emplace_back([&, i] {
+                for (int n = 0; n != 1000; ++n)
+                    log.record(log_event::added, space, i * 1000 + n, 0);
+            });
+        for (auto& th:threads)
+            th.join();
+    }
+    std::ifstream lines{json};
+    std::string line;
+    size_t count = 0;
+    int64_t last = 0;
+    bool ordered = true;
+    while (std::getline(lines, line)) {
+        auto t = std::stoll(line.substr(std::strlen("{\"time_ns\":")));
+        ordered = ordered && t >= last;
+        last = t;
+        ++count;
+    }
+    check(count == 4000, "every event written");
+    check(ordered, "written in time order");
+}
+}
+
+int main() {
+    const std::pair<const char*, void (*)()> tests[] = {
+        {"late fire batching", late_fire_batching},
+        {"priority deferral", priority_deferral},
+        {"admission limits", admission_limits},
+        {"journal replay", journal_replay},
+        {"torn tail", torn_tail},
+        {"group commit", group_commit},
+        {"snapshot round trip", snapshot_round_trip},
+        {"background snapshot", background_snapshot},
+        {"follower resync", follower_resync},
+        {"event log order", event_log_order},
+    };
+    for (auto& t:tests) {
+        std::cout << t.first << std::endl;
+        auto before = failures;
+        try {
+            t.second();
+        } catch (std::exception& e) {
+            ++failures;
+            std::cout << "  failed: " << e.what() << std::endl;
+        }
+        if (failures == before)
+            std::cout << "  ok" << std::endl;
+    }
+    std::cout << failures << (failures == 1 ? " check" : " checks") << " failed"
+              << std::endl;
+    return failures ? 1 : 0;
+}